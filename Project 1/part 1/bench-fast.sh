@@ -0,0 +1,83 @@
+#!/bin/sh
+# bench-fast.sh - compare the simulation speed of sim-fast builds
+#
+# usage: bench-fast.sh <simplesim-3.0 dir> <name>=<flags> ... -- <program> ...
+#
+#   $ ./bench-fast.sh ../simplesim-3.0 predecode="-O2" \
+#       fetch="-O2 -DNO_PREDECODE" -- test1 test2
+#   $ ./bench-fast.sh ../simplesim-3.0 threaded="-O3" \
+#       switch="-O3 -DNO_JUMP_TABLE" -- test1 test2
+#
+# Every build copies sim-fast.c and machine.def of this directory, and
+# checkpoint.c and checkpoint.h of Project 2, into the SimpleScalar tree,
+# links checkpoint.o into sim-fast in its Makefile and runs
+# `make sim-fast OFLAGS="<flags>"`.  Every program
+# is then run RUNS times (default 5) by each build.  sim_inst_rate only counts
+# whole seconds, too coarse for test1 and test2, so the rate printed is the
+# sim_num_insn of a run over its best wall clock time.
+
+RUNS=${RUNS:-5}
+HERE=$(cd "$(dirname "$0")" && pwd)
+
+if [ $# -lt 4 ]; then
+  sed -n '3,8p' "$0" >&2
+  exit 1
+fi
+SS=$1
+shift
+
+# builds are kept one per line, their flags may hold spaces
+NL='
+'
+BUILDS=
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  BUILDS="$BUILDS$1$NL"
+  shift
+done
+[ "$1" = "--" ] && shift
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+cp "$HERE/sim-fast.c" "$SS/sim-fast.c" || exit 1
+cp "$HERE/machine.def" "$SS/machine.def" || exit 1
+cp "$HERE/../../Project 2/checkpoint.c" "$SS/checkpoint.c" || exit 1
+cp "$HERE/../../Project 2/checkpoint.h" "$SS/checkpoint.h" || exit 1
+if ! grep -q 'sim-fast\.$(OEXT) checkpoint\.$(OEXT)' "$SS/Makefile"; then
+  sed '/^sim-fast\$(EEXT):/,/^$/s/sim-fast\.\$(OEXT)/& checkpoint.$(OEXT)/' \
+    "$SS/Makefile" > "$OUT/Makefile" && cp "$OUT/Makefile" "$SS/Makefile" \
+    || exit 1
+fi
+
+IFS=$NL
+
+for b in $BUILDS; do
+  name=${b%%=*}
+  flags=${b#*=}
+  echo "building $name: OFLAGS=\"$flags\"" >&2
+  (cd "$SS" && rm -f sim-fast sim-fast.o checkpoint.o && make sim-fast OFLAGS="$flags") \
+    > "$OUT/$name.log" 2>&1 || { cat "$OUT/$name.log" >&2; exit 1; }
+  cp "$SS/sim-fast" "$OUT/sim-fast.$name"
+done
+
+printf "%-12s" program
+for b in $BUILDS; do printf " %16s" "${b%%=*}"; done
+printf "\n"
+for prog in "$@"; do
+  printf "%-12s" "$(basename "$prog")"
+  for b in $BUILDS; do
+    name=${b%%=*}
+    best=
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+      start=$(date +%s%N)
+      "$OUT/sim-fast.$name" "$prog" > /dev/null 2> "$OUT/run.err"
+      end=$(date +%s%N)
+      t=$((end - start))
+      if [ -z "$best" ] || [ $t -lt "$best" ]; then best=$t; fi
+      i=$((i + 1))
+    done
+    insn=$(awk '$1 == "sim_num_insn" { print $2 }' "$OUT/run.err")
+    printf " %11.1f M/s" "$(echo "$insn $best" | awk '{ print $1 / $2 * 1000 }')"
+  done
+  printf "\n"
+done
@@ -0,0 +1,162 @@
+/* bench-ops.c - time the portable and host versions of addOK and bitCount
+ *
+ * Build it against the SimpleScalar tree holding this machine.def:
+ *
+ *   $ cp machine.def ../simplesim-3.0/
+ *   $ gcc -O2 -mpopcnt -I../simplesim-3.0 -o bench-ops bench-ops.c
+ *   $ ./bench-ops [iterations]
+ *
+ * Both versions first run over the operands of the test1 addOK calls, the
+ * test2 bitCount calls, edge cases and random words, and must agree.
+ * Then each is run for the given iterations (default 100000000), bitCount
+ * over the operands of the test2 bitCount loop and addOK over random
+ * words, and its cost is printed in ns per instruction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+
+#if !defined(__clang__) && !(defined(__GNUC__) && __GNUC__ >= 5)
+#error bench-ops.c needs the GCC builtins of MD_ADDOK_HOST and MD_BITCOUNT_HOST
+#endif
+
+/* keep the compiler from folding or vectorizing a loop over V */
+#define OPAQUE(V)	__asm__ volatile("" : "+r" (V))
+
+#define NOPS 64
+
+/* operands of addOK and bitCount */
+static sword_t add_ops[NOPS], bc_ops[NOPS];
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* addOK of add_ops[i] and add_ops[i + 1] for N iterations, returns the
+   sum of the results so the work is not dead */
+#define BENCH_ADDOK(NAME, ADDOK)					\
+static int								\
+NAME(long n)								\
+{									\
+  long i;								\
+  int ok, sum = 0;							\
+  sword_t x, y;								\
+  for (i = 0; i < n; i++) {						\
+    x = add_ops[i & (NOPS - 1)];					\
+    y = add_ops[(i + 1) & (NOPS - 1)];					\
+    OPAQUE(x);								\
+    ADDOK(ok, x, y);							\
+    sum += ok;								\
+  }									\
+  return sum;								\
+}
+
+#define BENCH_BITCOUNT(NAME, BITCOUNT)					\
+static int								\
+NAME(long n)								\
+{									\
+  long i;								\
+  int c, sum = 0;							\
+  for (i = 0; i < n; i++) {						\
+    c = bc_ops[i & (NOPS - 1)];						\
+    OPAQUE(c);								\
+    BITCOUNT(c);							\
+    sum += c;								\
+  }									\
+  return sum;								\
+}
+
+BENCH_ADDOK(addok_c, MD_ADDOK_C)
+BENCH_ADDOK(addok_host, MD_ADDOK_HOST)
+BENCH_BITCOUNT(bitcount_c, MD_BITCOUNT_C)
+BENCH_BITCOUNT(bitcount_host, MD_BITCOUNT_HOST)
+
+/* check that both versions agree on X and Y */
+static void
+check(sword_t x, sword_t y)
+{
+  int a, b, c = x, d = x;
+
+  MD_ADDOK_C(a, x, y);
+  MD_ADDOK_HOST(b, x, y);
+  if (a != b) {
+    fprintf(stderr, "addOK 0x%08x 0x%08x: %d in C, %d on the host\n",
+	    (word_t)x, (word_t)y, a, b);
+    exit(1);
+  }
+  MD_BITCOUNT_C(c);
+  MD_BITCOUNT_HOST(d);
+  if (c != d) {
+    fprintf(stderr, "bitCount 0x%08x: %d in C, %d on the host\n",
+	    (word_t)x, c, d);
+    exit(1);
+  }
+}
+
+static void
+run(char *name, int (*c)(long), int (*host)(long), long n)
+{
+  double start, t_c, t_host;
+  int r_c, r_host;
+
+  start = now();
+  r_c = c(n);
+  t_c = now() - start;
+  start = now();
+  r_host = host(n);
+  t_host = now() - start;
+  if (r_c != r_host) {
+    fprintf(stderr, "%s: sums differ, %d in C, %d on the host\n",
+	    name, r_c, r_host);
+    exit(1);
+  }
+  printf("%-10s %8.2f ns %8.2f ns %8.2fx\n", name,
+	 t_c / n * 1e9, t_host / n * 1e9, t_c / t_host);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const sword_t edge[] = {
+    0, 1, -1, 2, -2, 5, 7, MAXINT_VAL, -MAXINT_VAL, -MAXINT_VAL - 1,
+    0x40000000, -0x40000000, 0x55555555, 0x0f0f0f0f
+  };
+  long n = argc > 1 ? atol(argv[1]) : 100000000;
+  int i, j;
+
+  if (n <= 0) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    exit(1);
+  }
+
+  /* the test1 addOK calls, then every pair of edge cases */
+  check(1, -1);
+  check(-MAXINT_VAL - 1, -MAXINT_VAL - 1);
+  for (i = 0; i < sizeof(edge) / sizeof(edge[0]); i++)
+    for (j = 0; j < sizeof(edge) / sizeof(edge[0]); j++)
+      check(edge[i], edge[j]);
+  srand(1);
+  for (i = 0; i < 1000000; i++)
+    check(((word_t)rand() << 16) ^ rand(), ((word_t)rand() << 16) ^ rand());
+
+  /* test_bitCount() of test2 shifts its argument, the 5 and 7 of main(),
+     right by 0 to 31 */
+  for (i = 0; i < NOPS; i++) {
+    bc_ops[i] = (i < 32 ? 5 : 7) >> (i & 31);
+    add_ops[i] = ((word_t)rand() << 16) ^ rand();
+  }
+
+  printf("%-10s %11s %11s %9s\n", "insn", "C", "host", "speedup");
+  run("addOK", addok_c, addok_host, n);
+  run("bitCount", bitcount_c, bitcount_host, n);
+  return 0;
+}
@@ -51,6 +51,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 /*
@@ -69,12 +70,34 @@
 /* don't count instructions flag, enabled by default, disable for inst count */
 #undef NO_INSN_COUNT
 
-#ifdef __GNUC__
-/* faster dispatch mechanism, requires GNU GCC C extensions, CAVEAT: some
-   versions of GNU GCC core dump when optimizing the jump table code with
-   optimization levels higher than -O1 */
-/* #define USE_JUMP_TABLE */
-#endif /* __GNUC__ */
+#if defined(__GNUC__) && !defined(NO_JUMP_TABLE)
+/* faster dispatch mechanism, threads the instruction implementations
+   together through a table of label addresses, requires the GNU C labels
+   as values extension (GCC and Clang), enabled by default, define
+   NO_JUMP_TABLE to fall back to the switch dispatch loop */
+#define USE_JUMP_TABLE
+#endif /* __GNUC__ && !NO_JUMP_TABLE */
+
+/* execute PISA code out of a predecoded copy of the text segment instead
+   of fetching and decoding every instruction through the paged memory,
+   enabled by default, define NO_PREDECODE to disable */
+/* #define NO_PREDECODE */
+
+/* run PISA code a basic block at a time out of a cache of translated
+   blocks, chained together on their static successors, requires
+   USE_JUMP_TABLE and predecoding, enabled by default, define NO_BB_CACHE
+   to disable */
+/* #define NO_BB_CACHE */
+
+/* compile the hot translated blocks to x86-64 host code, requires the
+   block cache and an x86-64 host, disabled by default, define USE_JIT to
+   enable */
+/* #define USE_JIT */
+
+#ifdef USE_JIT
+#include <stddef.h>
+#include <sys/mman.h>
+#endif /* USE_JIT */
 
 #include "host.h"
 #include "misc.h"
@@ -85,6 +108,7 @@
 #include "syscall.h"
 #include "dlite.h"
 #include "sim.h"
+#include "checkpoint.h"
 
 /* simulated registers */
 static struct regs_t regs;
@@ -97,6 +121,655 @@ static struct mem_t *mem = NULL;
 static struct mem_t *dec = NULL;
 #endif
 
+#if defined(TARGET_PISA) && !defined(NO_PREDECODE)
+#define USE_PREDECODE
+
+/* predecoded PISA instruction, with the operand fields used by most
+   instruction implementations already extracted */
+struct pdec_t {
+  enum md_opcode op;		/* opcode, OP_NA until (re)decoded */
+  md_inst_t inst;		/* raw instruction */
+  int imm;			/* IMM, sign-extended immediate */
+  unsigned char rs, rt, rd;	/* RS, RT and RD register fields */
+};
+
+/* predecoded text segment, one record per instruction */
+static struct pdec_t *pdec = NULL;
+
+/* record for an instruction outside the text segment */
+static struct pdec_t pdec_tmp;
+
+/* set when the program writes its text segment, cleared by whoever drops
+   the copies of the text made after predecoding (the block cache) */
+static int text_written = FALSE;
+
+/* decode the instruction at PC into a record */
+static void
+pdec_decode(struct pdec_t *pd, md_addr_t PC)
+{
+  md_inst_t inst;
+
+  MD_FETCH_INST(inst, mem, PC);
+  MD_SET_OPCODE(pd->op, inst);
+  pd->inst = inst;
+  pd->imm = IMM;
+  pd->rs = RS;
+  pd->rt = RT;
+  pd->rd = RD;
+}
+
+/* invalidate the records of text written at [ADDR, ADDR + NBYTES), they
+   are decoded again when next executed */
+static void
+pdec_invalidate(md_addr_t addr, int nbytes)
+{
+  md_addr_t a;
+
+  for (a = addr & ~(sizeof(md_inst_t) - 1); a < addr + nbytes;
+       a += sizeof(md_inst_t))
+    if ((md_addr_t)(a - ld_text_base) < ld_text_size)
+      {
+	pdec[(a - ld_text_base) / sizeof(md_inst_t)].op = OP_NA;
+	text_written = TRUE;
+      }
+}
+
+/* memory accessor of the system calls, keeps the predecoded text coherent */
+static enum md_fault_type
+pdec_mem_access(struct mem_t *mem, enum mem_cmd cmd, md_addr_t addr,
+		void *vp, int nbytes)
+{
+  if (cmd == Write)
+    pdec_invalidate(addr, nbytes);
+  return mem_access(mem, cmd, addr, vp, nbytes);
+}
+#endif /* TARGET_PISA && !NO_PREDECODE */
+
+#if defined(USE_PREDECODE) && defined(USE_JUMP_TABLE) && !defined(NO_BB_CACHE)
+#define USE_BB_CACHE
+
+/* most instructions in a translated block */
+#define BB_MAX_INSN		64
+
+/* records of the block cache per instruction of the text segment, the
+   cache is flushed when it fills up */
+#define BB_POOL_FACTOR		4
+
+/* pseudo instructions of a translated block, indices of bb_handler[]
+   after the opcodes */
+#define BB_ZERO			(OP_MAX + 0)	/* zero $r0 again */
+#define BB_EXIT			(OP_MAX + 1)	/* leave after a branch or trap */
+#define BB_CUT			(OP_MAX + 2)	/* leave, falling through */
+
+/* an instruction of a translated block */
+struct bb_rec {
+  void *handler;		/* implementation label in sim_main() */
+  md_addr_t pc;			/* its PC, the next PC for BB_CUT */
+  unsigned int rest;		/* instructions of the block after it */
+  struct pdec_t d;		/* predecoded instruction */
+};
+
+/* a translated basic block, entered at PC and left after its first
+   control or trap instruction */
+struct bb_t {
+  md_addr_t pc;			/* entry PC */
+  unsigned int ninsn;		/* instructions in the block */
+  int indirect;			/* ends in an indirect jump, never chained */
+  md_addr_t succ_pc[2];		/* entry PCs of the chained successors */
+  struct bb_t *succ[2];		/* chained successors, NULL until seen */
+  struct bb_rec *rec;		/* its instructions, then BB_EXIT/BB_CUT */
+#ifdef USE_JIT
+  unsigned int hot;		/* runs so far, compiled at jit_hot */
+  unsigned int (*jit)(struct regs_t *);	/* host code, NULL until compiled,
+					   returns the instructions it left
+					   unrun */
+#endif /* USE_JIT */
+};
+
+/* block entered at each text PC, NULL until translated */
+static struct bb_t **bb_map = NULL;
+
+/* storage of the blocks and their records */
+static struct bb_t *bb_blocks = NULL;
+static unsigned int bb_nblocks = 0;
+static struct bb_rec *bb_recs = NULL;
+static unsigned int bb_nrecs = 0, bb_max_recs = 0;
+
+/* implementation labels of sim_main() for a block, by opcode and then
+   pseudo instruction */
+static void **bb_handler = NULL;
+
+/* block cache statistics */
+static counter_t bb_num_xlate = 0;
+static counter_t bb_num_flush = 0;
+#endif /* USE_PREDECODE && USE_JUMP_TABLE && !NO_BB_CACHE */
+
+#ifdef USE_JIT
+#if !defined(USE_BB_CACHE) || !defined(__x86_64__)
+#error USE_JIT requires the block cache and an x86-64 host
+#endif
+
+/* runs of a block before it is compiled */
+static int jit_hot;
+
+/* run every compiled block on the interpreter first and compare */
+static int jit_check;
+
+/* executable memory holding the compiled blocks, emptied along with the
+   block cache */
+#define JIT_CACHE_SIZE		(16 << 20)
+static unsigned char *jit_cache = NULL;
+static unsigned int jit_used = 0;
+
+/* most host code bytes for a block */
+#define JIT_MAX_CODE		((2 * BB_MAX_INSN + 1) * 64 + 32)
+
+/* memory writes of the block checked under -jit:check, to roll back */
+#define JIT_LOG_SIZE		(4 * BB_MAX_INSN)
+struct jit_write {
+  md_addr_t addr;		/* address written */
+  int nbytes;			/* bytes written */
+  byte_t old[8];		/* previous contents */
+};
+static struct jit_write jit_log[JIT_LOG_SIZE];
+static int jit_nlog = 0;
+static int jit_logging = FALSE;
+
+/* compiler statistics */
+static counter_t jit_num_xlate = 0;
+static counter_t jit_num_checked = 0;
+
+static void jit_log_write(md_addr_t addr, int nbytes);
+#endif /* USE_JIT */
+
+/* basic block vector profile, as SimPoint takes it: the run is cut into
+   intervals of bbv_interval instructions, and the vector of an interval
+   holds the instructions each basic block ran in it; the vectors are
+   randomly projected down to BBV_DIM dimensions and clustered with
+   k-means, and the interval closest to the centre of each cluster stands
+   for all the others in it */
+
+/* dimensions of the projected vectors */
+#define BBV_DIM			15
+
+/* random initial centres tried for each number of clusters */
+#define SP_SEEDS		5
+
+/* k-means passes at most, for one set of initial centres */
+#define SP_MAX_ITER		100
+
+/* the fewest clusters whose BIC score is this fraction of the way from
+   the worst score to the best are picked */
+#define SP_BIC_THRESHOLD	0.9
+
+/* basic block vector file, NULL for none */
+static char *bbv_name;
+
+/* simpoint file, NULL for none */
+static char *sp_name;
+
+/* instructions of an interval */
+static int bbv_interval;
+
+/* most clusters tried */
+static int sp_maxk;
+
+/* profiling, set if either output file is wanted */
+static int bbv_on = FALSE;
+
+static FILE *bbv_fd = NULL;
+
+/* block ids by entry PC, an open-addressed hash table */
+static md_addr_t *bbv_pcs = NULL;
+static unsigned int *bbv_ids = NULL;
+static unsigned int bbv_mask = 0;
+static unsigned int bbv_nids = 0, bbv_max_ids = 0;
+
+/* random projection of each block id, BBV_DIM values in [-1, 1] */
+static double *bbv_proj = NULL;
+
+/* instructions of each block in the current interval, and the blocks
+   that ran in it */
+static counter_t *bbv_hits = NULL;
+static unsigned int *bbv_touched = NULL;
+static unsigned int bbv_ntouched = 0;
+
+/* first instruction after the current interval */
+static counter_t bbv_end;
+
+/* projected vectors of the finished intervals */
+static double *bbv_vecs = NULL;
+static unsigned int bbv_nvecs = 0, bbv_max_vecs = 0;
+
+#ifndef USE_BB_CACHE
+/* entry PC and first instruction of the block being run, when blocks are
+   found one instruction at a time */
+static md_addr_t bbv_pc;
+static counter_t bbv_start = 0;
+#endif /* !USE_BB_CACHE */
+
+/* seed of the projection and of the initial centres, fixed so the same
+   run always picks the same simpoints */
+static unsigned int sp_seed = 1;
+
+/* random value in [0, 1) */
+static double
+sp_rand(void)
+{
+  sp_seed = sp_seed * 1103515245 + 12345;
+  return (sp_seed >> 8) / (double)(1 << 24);
+}
+
+/* id of the block entered at PC, one is made the first time */
+static unsigned int
+bbv_lookup(md_addr_t pc)
+{
+  unsigned int i, j, id;
+
+  for (i = (pc >> 3) * 2654435761u & bbv_mask; bbv_ids[i]; i = (i+1) & bbv_mask)
+    if (bbv_pcs[i] == pc)
+      return bbv_ids[i] - 1;
+
+  id = bbv_nids++;
+  if (bbv_nids > bbv_max_ids)
+    {
+      bbv_max_ids *= 2;
+      bbv_proj = (double *)realloc(bbv_proj,
+				   bbv_max_ids * BBV_DIM * sizeof(double));
+      bbv_hits = (counter_t *)realloc(bbv_hits,
+				      bbv_max_ids * sizeof(counter_t));
+      bbv_touched = (unsigned int *)realloc(bbv_touched,
+					    bbv_max_ids * sizeof(unsigned int));
+      if (!bbv_proj || !bbv_hits || !bbv_touched)
+	fatal("out of virtual memory");
+    }
+  for (j=0; j < BBV_DIM; j++)
+    bbv_proj[id * BBV_DIM + j] = 2.0 * sp_rand() - 1.0;
+  bbv_hits[id] = 0;
+
+  bbv_pcs[i] = pc;
+  bbv_ids[i] = id + 1;
+
+  /* keep the table at most half full */
+  if (2 * bbv_nids > bbv_mask)
+    {
+      md_addr_t *pcs = bbv_pcs;
+      unsigned int *ids = bbv_ids, size = bbv_mask + 1;
+
+      bbv_mask = 2 * size - 1;
+      bbv_pcs = (md_addr_t *)calloc(2 * size, sizeof(md_addr_t));
+      bbv_ids = (unsigned int *)calloc(2 * size, sizeof(unsigned int));
+      if (!bbv_pcs || !bbv_ids)
+	fatal("out of virtual memory");
+      for (i=0; i < size; i++)
+	if (ids[i])
+	  {
+	    for (j = (pcs[i] >> 3) * 2654435761u & bbv_mask; bbv_ids[j];
+		 j = (j+1) & bbv_mask)
+	      ;
+	    bbv_pcs[j] = pcs[i];
+	    bbv_ids[j] = ids[i];
+	  }
+      free(pcs);
+      free(ids);
+    }
+  return id;
+}
+
+/* end the current interval: write its vector out, in the SimPoint format
+   (1-based block ids), and keep its projection if it is a full one */
+static void
+bbv_close(int full)
+{
+  unsigned int i, j, id;
+  counter_t total = 0;
+  double *vec;
+
+  if (bbv_fd)
+    {
+      fputc('T', bbv_fd);
+      for (i=0; i < bbv_ntouched; i++)
+	fprintf(bbv_fd, ":%u:%.0f ", bbv_touched[i] + 1,
+		(double)bbv_hits[bbv_touched[i]]);
+      fputc('\n', bbv_fd);
+    }
+
+  if (full)
+    {
+      if (bbv_nvecs == bbv_max_vecs)
+	{
+	  bbv_max_vecs = bbv_max_vecs ? 2 * bbv_max_vecs : 1024;
+	  bbv_vecs = (double *)realloc(bbv_vecs,
+				       bbv_max_vecs * BBV_DIM * sizeof(double));
+	  if (!bbv_vecs)
+	    fatal("out of virtual memory");
+	}
+      vec = bbv_vecs + bbv_nvecs++ * BBV_DIM;
+      for (j=0; j < BBV_DIM; j++)
+	vec[j] = 0.0;
+      for (i=0; i < bbv_ntouched; i++)
+	total += bbv_hits[bbv_touched[i]];
+      /* the vector is normalized to the instructions of the interval */
+      for (i=0; i < bbv_ntouched; i++)
+	{
+	  id = bbv_touched[i];
+	  for (j=0; j < BBV_DIM; j++)
+	    vec[j] += bbv_hits[id] * bbv_proj[id * BBV_DIM + j] / total;
+	}
+    }
+
+  for (i=0; i < bbv_ntouched; i++)
+    bbv_hits[bbv_touched[i]] = 0;
+  bbv_ntouched = 0;
+  bbv_end += bbv_interval;
+}
+
+/* count N instructions run by the block entered at PC, the first of them
+   being instruction START of the run */
+static void
+bbv_count(md_addr_t pc, counter_t start, counter_t n)
+{
+  unsigned int id;
+
+  /* a block goes to the interval it starts in */
+  while (start >= bbv_end)
+    bbv_close(TRUE);
+
+  id = bbv_lookup(pc);
+  if (!bbv_hits[id])
+    bbv_touched[bbv_ntouched++] = id;
+  bbv_hits[id] += n;
+}
+
+#ifndef USE_BB_CACHE
+/* a control instruction ends the block being run, the next one is
+   entered at NPC */
+static void
+bbv_ctrl(void)
+{
+  bbv_count(bbv_pc, bbv_start, sim_num_insn - bbv_start);
+  bbv_pc = regs.regs_NPC;
+  bbv_start = sim_num_insn;
+}
+#endif /* !USE_BB_CACHE */
+
+/* squared distance of two projected vectors */
+static double
+sp_dist(double *a, double *b)
+{
+  double d, sum = 0.0;
+  int j;
+
+  for (j=0; j < BBV_DIM; j++)
+    {
+      d = a[j] - b[j];
+      sum += d * d;
+    }
+  return sum;
+}
+
+/* cluster the N vectors into K clusters, best of SP_SEEDS runs from random
+   initial centres; leave the centres in CENT, the cluster of each vector
+   in ASSIGN, and return the sum of the squared distances to the centres */
+static double
+sp_kmeans(int n, int k, double *cent, int *assign)
+{
+  double *c = (double *)malloc(k * BBV_DIM * sizeof(double));
+  int *a = (int *)malloc(n * sizeof(int)), *size = (int *)malloc(k * sizeof(int));
+  double best = -1.0, dist, d, min;
+  int seed, iter, i, j, m, changed;
+
+  if (!c || !a || !size)
+    fatal("out of virtual memory");
+
+  for (seed=0; seed < SP_SEEDS; seed++)
+    {
+      /* k distinct vectors are the initial centres */
+      for (i=0; i < n; i++)
+	a[i] = -1;
+      for (m=0; m < k; m++)
+	{
+	  do
+	    i = (int)(sp_rand() * n);
+	  while (a[i] >= 0);
+	  a[i] = m;
+	  memcpy(c + m * BBV_DIM, bbv_vecs + i * BBV_DIM,
+		 BBV_DIM * sizeof(double));
+	}
+
+      for (iter=0; iter < SP_MAX_ITER; iter++)
+	{
+	  /* each vector goes to its nearest centre */
+	  changed = FALSE;
+	  dist = 0.0;
+	  for (i=0; i < n; i++)
+	    {
+	      for (m=0, j=0, min=-1.0; m < k; m++)
+		{
+		  d = sp_dist(bbv_vecs + i * BBV_DIM, c + m * BBV_DIM);
+		  if (min < 0.0 || d < min)
+		    min = d, j = m;
+		}
+	      if (a[i] != j)
+		a[i] = j, changed = TRUE;
+	      dist += min;
+	    }
+	  if (!changed)
+	    break;
+
+	  /* each centre moves to the mean of its vectors, an empty cluster
+	     keeps its centre */
+	  for (m=0; m < k; m++)
+	    size[m] = 0;
+	  for (i=0; i < n; i++)
+	    size[a[i]]++;
+	  for (m=0; m < k; m++)
+	    if (size[m])
+	      for (j=0; j < BBV_DIM; j++)
+		c[m * BBV_DIM + j] = 0.0;
+	  for (i=0; i < n; i++)
+	    for (j=0; j < BBV_DIM; j++)
+	      c[a[i] * BBV_DIM + j] += bbv_vecs[i * BBV_DIM + j] / size[a[i]];
+	}
+
+      if (best < 0.0 || dist < best)
+	{
+	  best = dist;
+	  memcpy(cent, c, k * BBV_DIM * sizeof(double));
+	  memcpy(assign, a, n * sizeof(int));
+	}
+    }
+
+  free(c);
+  free(a);
+  free(size);
+  return best;
+}
+
+/* Bayesian information criterion of a clustering of N vectors into K
+   clusters with given distortion, for spherical Gaussian clusters of one
+   variance (Pelleg and Moore's X-means, as used by SimPoint); higher is
+   better */
+static double
+sp_bic(int n, int k, double dist, int *assign)
+{
+  double var, loglik = 0.0;
+  int *size = (int *)calloc(k, sizeof(int)), i;
+
+  if (!size)
+    fatal("out of virtual memory");
+  for (i=0; i < n; i++)
+    size[assign[i]]++;
+
+  /* variance of each dimension, kept off 0 for identical vectors */
+  var = dist / ((double)BBV_DIM * (n - k));
+  if (var < 1e-12)
+    var = 1e-12;
+  for (i=0; i < k; i++)
+    if (size[i])
+      loglik += size[i] * log((double)size[i] / n);
+  loglik -= 0.5 * n * BBV_DIM * log(2.0 * M_PI * var);
+  loglik -= 0.5 * BBV_DIM * (n - k);
+
+  free(size);
+  return loglik - 0.5 * k * (BBV_DIM + 1) * log((double)n);
+}
+
+/* cluster the full intervals, and write the interval standing for each
+   cluster and its weight to the simpoint file */
+static void
+sp_write(void)
+{
+  int n = bbv_nvecs, maxk, k, best_k, i, m, *assign, *rep, *size;
+  double *cent, *bic, lo, hi, d, *rep_dist;
+  FILE *fd;
+
+  if (n == 0)
+    fatal("the program ran fewer than -bbv:interval (%d) insts",
+	  bbv_interval);
+
+  /* the variance needs more vectors than clusters */
+  maxk = MIN(sp_maxk, n - 1);
+  if (maxk < 1)
+    maxk = 1;
+
+  cent = (double *)malloc(maxk * BBV_DIM * sizeof(double));
+  bic = (double *)malloc((maxk + 1) * sizeof(double));
+  assign = (int *)malloc(n * sizeof(int));
+  rep = (int *)malloc(maxk * sizeof(int));
+  size = (int *)malloc(maxk * sizeof(int));
+  rep_dist = (double *)malloc(maxk * sizeof(double));
+  if (!cent || !bic || !assign || !rep || !size || !rep_dist)
+    fatal("out of virtual memory");
+
+  /* score every number of clusters, then take the fewest scoring close
+     enough to the best */
+  for (k=1; k <= maxk; k++)
+    bic[k] = n > k ? sp_bic(n, k, sp_kmeans(n, k, cent, assign), assign) : 0.0;
+  lo = hi = bic[1];
+  for (k=2; k <= maxk; k++)
+    {
+      lo = MIN(lo, bic[k]);
+      hi = MAX(hi, bic[k]);
+    }
+  for (best_k=1; bic[best_k] < lo + SP_BIC_THRESHOLD * (hi - lo); best_k++)
+    ;
+
+  /* the vector closest to each centre stands for its cluster */
+  sp_kmeans(n, best_k, cent, assign);
+  for (m=0; m < best_k; m++)
+    {
+      rep[m] = -1;
+      size[m] = 0;
+    }
+  for (i=0; i < n; i++)
+    {
+      m = assign[i];
+      d = sp_dist(bbv_vecs + i * BBV_DIM, cent + m * BBV_DIM);
+      if (rep[m] < 0 || d < rep_dist[m])
+	{
+	  rep[m] = i;
+	  rep_dist[m] = d;
+	}
+      size[m]++;
+    }
+
+  fd = fopen(sp_name, "w");
+  if (!fd)
+    fatal("cannot open simpoint file `%s'", sp_name);
+  fprintf(fd, "# simpoints of %d intervals of %d insts, %d clusters\n",
+	  n, bbv_interval, best_k);
+  fprintf(fd, "insn %.0f\n", (double)sim_num_insn);
+  fprintf(fd, "interval %d\n", bbv_interval);
+  /* in the order of the run, so they can be simulated in one pass */
+  for (i=0; i < n; i++)
+    for (m=0; m < best_k; m++)
+      if (rep[m] == i)
+	fprintf(fd, "point %d %.6f\n", i, (double)size[m] / n);
+  fclose(fd);
+
+  fprintf(stderr, "sim: %d intervals in %d clusters, simpoints written "
+	  "to `%s'\n", n, best_k, sp_name);
+
+  free(cent);
+  free(bic);
+  free(assign);
+  free(rep);
+  free(size);
+  free(rep_dist);
+}
+
+/* architected state checkpoints, see checkpoint.h: one is written when
+   the instruction count reaches ckpt_at, then one every ckpt_every
+   instructions if set, and a run can start from one instead of the
+   program entry */
+
+/* checkpoint to write, NULL for none, and the instructions run before it;
+   with ckpt_every the checkpoints go to NAME.0, NAME.1 .. and NAME lists
+   them for sim-pipe -ckpt:sample */
+static char *ckpt_name;
+static int ckpt_at;
+static int ckpt_every;
+
+/* instruction counts of the checkpoints written */
+static counter_t *ckpt_insn = NULL;
+static int ckpt_num = 0;
+
+/* checkpoint to start from, NULL to load the program */
+static char *ckpt_load_name;
+
+/* instruction count at which the next checkpoint is taken, never reached
+   when there is none */
+static counter_t ckpt_next = (counter_t)1e18;
+
+/* write the checkpoint, the next instruction to run being at PC */
+static void
+ckpt_take(md_addr_t pc)
+{
+  struct regs_t cregs = regs;
+  char fname[1024];
+
+  fprintf(stderr, "sim: ** checkpoint at %.0f insts **\n",
+	  (double)sim_num_insn);
+  cregs.regs_PC = pc;
+  cregs.regs_NPC = pc + sizeof(md_inst_t);
+  cregs.regs_R[MD_REG_ZERO] = 0;
+  if (!ckpt_every)
+    {
+      fclose(ckpt_save(ckpt_name, NULL, sim_num_insn, &cregs, mem));
+      ckpt_next = (counter_t)1e18;
+      return;
+    }
+
+  sprintf(fname, "%s.%d", ckpt_name, ckpt_num);
+  fclose(ckpt_save(fname, NULL, sim_num_insn, &cregs, mem));
+  ckpt_insn = (counter_t *)realloc(ckpt_insn,
+				   (ckpt_num + 1) * sizeof(counter_t));
+  if (!ckpt_insn)
+    fatal("out of virtual memory");
+  ckpt_insn[ckpt_num++] = sim_num_insn;
+  ckpt_next += ckpt_every;
+}
+
+/* list the checkpoints of -ckpt:every, with the instructions of the whole
+   run: lines "insn N", "every N" and "ckpt FILE INSN", and # comments */
+static void
+ckpt_write_index(void)
+{
+  FILE *fd;
+  int i;
+
+  fd = fopen(ckpt_name, "w");
+  if (!fd)
+    fatal("cannot open checkpoint list `%s'", ckpt_name);
+  fprintf(fd, "# checkpoints of sim-fast -ckpt:every\n");
+  fprintf(fd, "insn %.0f\n", (double)sim_num_insn);
+  fprintf(fd, "every %d\n", ckpt_every);
+  for (i=0; i < ckpt_num; i++)
+    fprintf(fd, "ckpt %s.%d %.0f\n", ckpt_name, i, (double)ckpt_insn[i]);
+  fclose(fd);
+}
+
 /* register simulator-specific options */
 void
 sim_reg_options(struct opt_odb_t *odb)
@@ -110,6 +783,51 @@ sim_reg_options(struct opt_odb_t *odb)
 "causing sim-fast to execute incorrectly or dump core.  Such is the\n"
 "price we pay for speed!!!!\n"
 		 );
+#ifdef USE_JIT
+  opt_reg_int(odb, "-jit:hot",
+	      "runs of a basic block before it is compiled to host code",
+	      &jit_hot, /* default */50,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-jit:check",
+	       "run each compiled block on the interpreter as well, and stop "
+	       "at the first difference",
+	       &jit_check, /* default */FALSE,
+	       /* print */TRUE, /* format */NULL);
+#endif /* USE_JIT */
+
+  opt_reg_string(odb, "-bbv:file",
+		 "write the basic block vector of every interval to this file",
+		 &bbv_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bbv:interval",
+	      "instructions of a basic block vector interval",
+	      &bbv_interval, /* default */1000000,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-simpoint:file",
+		 "cluster the intervals and write the simpoints to this file",
+		 &sp_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-simpoint:maxk",
+	      "most clusters (simpoints) tried",
+	      &sp_maxk, /* default */10,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-ckpt:save",
+		 "write a checkpoint of the architected state to this file",
+		 &ckpt_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ckpt:at",
+	      "instructions run before the checkpoint is written",
+	      &ckpt_at, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ckpt:every",
+	      "instructions between checkpoints after the first, 0 for one",
+	      &ckpt_every, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-ckpt:load",
+		 "start from this checkpoint instead of the program entry",
+		 &ckpt_load_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
 }
 
 /* check simulator-specific option values */
@@ -118,6 +836,37 @@ sim_check_options(struct opt_odb_t *odb, int argc, char **argv)
 {
   if (dlite_active)
     fatal("sim-fast does not support DLite debugging");
+#ifdef USE_JIT
+  if (jit_hot < 1)
+    fatal("-jit:hot must be at least 1");
+#endif /* USE_JIT */
+
+  bbv_on = bbv_name || sp_name;
+  if (bbv_on)
+    {
+#ifdef NO_INSN_COUNT
+      fatal("basic block vectors need the instruction count");
+#endif /* NO_INSN_COUNT */
+      if (bbv_interval < 1)
+	fatal("-bbv:interval must be at least 1");
+      if (sp_maxk < 1)
+	fatal("-simpoint:maxk must be at least 1");
+      if (ckpt_load_name)
+	fatal("basic block vectors start from the program entry, not a "
+	      "checkpoint");
+    }
+
+  if (ckpt_name)
+    {
+#ifdef NO_INSN_COUNT
+      fatal("checkpoints need the instruction count");
+#endif /* NO_INSN_COUNT */
+      if (ckpt_at < 0 || ckpt_every < 0)
+	fatal("-ckpt:at and -ckpt:every must not be negative");
+      if (strlen(ckpt_name) > 1000)
+	fatal("checkpoint name `%s' is too long", ckpt_name);
+      ckpt_next = ckpt_at;
+    }
 }
 
 /* register simulator-specific statistics */
@@ -142,6 +891,22 @@ sim_reg_stats(struct stat_sdb_t *sdb)
 #ifdef TARGET_ALPHA
   mem_reg_stats(dec, sdb);
 #endif
+#ifdef USE_BB_CACHE
+  stat_reg_counter(sdb, "bb_num_xlate",
+		   "total number of basic blocks translated",
+		   &bb_num_xlate, bb_num_xlate, NULL);
+  stat_reg_counter(sdb, "bb_num_flush",
+		   "total number of block cache flushes",
+		   &bb_num_flush, bb_num_flush, NULL);
+#endif /* USE_BB_CACHE */
+#ifdef USE_JIT
+  stat_reg_counter(sdb, "jit_num_xlate",
+		   "total number of basic blocks compiled to host code",
+		   &jit_num_xlate, jit_num_xlate, NULL);
+  stat_reg_counter(sdb, "jit_num_checked",
+		   "total number of compiled block runs checked",
+		   &jit_num_checked, jit_num_checked, NULL);
+#endif /* USE_JIT */
 }
 
 /* initialize the simulator */
@@ -154,6 +919,26 @@ sim_init(void)
   /* allocate and initialize memory space */
   mem = mem_create("mem");
   mem_init(mem);
+
+  if (bbv_on)
+    {
+      if (bbv_name)
+	{
+	  bbv_fd = fopen(bbv_name, "w");
+	  if (!bbv_fd)
+	    fatal("cannot open basic block vector file `%s'", bbv_name);
+	}
+      bbv_mask = 1023;
+      bbv_max_ids = 512;
+      bbv_pcs = (md_addr_t *)calloc(bbv_mask + 1, sizeof(md_addr_t));
+      bbv_ids = (unsigned int *)calloc(bbv_mask + 1, sizeof(unsigned int));
+      bbv_proj = (double *)malloc(bbv_max_ids * BBV_DIM * sizeof(double));
+      bbv_hits = (counter_t *)malloc(bbv_max_ids * sizeof(counter_t));
+      bbv_touched = (unsigned int *)malloc(bbv_max_ids * sizeof(unsigned int));
+      if (!bbv_pcs || !bbv_ids || !bbv_proj || !bbv_hits || !bbv_touched)
+	fatal("out of virtual memory");
+      bbv_end = bbv_interval;
+    }
 }
 
 /* load program into simulated state */
@@ -162,8 +947,26 @@ sim_load_prog(char *fname,		/* program to load */
 	      int argc, char **argv,	/* program arguments */
 	      char **envp)		/* program environment */
 {
-  /* load program text and data, set up environment, memory, and regs */
-  ld_load_prog(fname, argc, argv, envp, &regs, mem, TRUE);
+  if (ckpt_load_name)
+    {
+      struct ckpt_header hdr;
+      FILE *fd;
+
+      /* the checkpoint stands for the loaded program, run up to it */
+      fd = ckpt_load(ckpt_load_name, &hdr, &regs, mem);
+      if (hdr.sim[0])
+	fatal("checkpoint `%s' holds %s state in flight, sim-fast can only "
+	      "start from an architected one", ckpt_load_name, hdr.sim);
+      fclose(fd);
+      sim_num_insn = hdr.insn;
+      if (ckpt_next < sim_num_insn)
+	fatal("checkpoint `%s' is past -ckpt:at", ckpt_load_name);
+    }
+  else
+    {
+      /* load program text and data, set up environment, memory, and regs */
+      ld_load_prog(fname, argc, argv, envp, &regs, mem, TRUE);
+    }
 
 #ifdef TARGET_ALPHA
   /* pre-decode text segment */
@@ -197,6 +1000,42 @@ sim_load_prog(char *fname,		/* program to load */
     fprintf(stderr, "done\n");
   }
 #endif /* TARGET_ALPHA */
+
+#ifdef USE_PREDECODE
+  /* pre-decode text segment into a dense array */
+  {
+    unsigned i, num_insn = ld_text_size / sizeof(md_inst_t);
+
+    fprintf(stderr, "** pre-decoding %u insts...", num_insn);
+
+    pdec = (struct pdec_t *)calloc(num_insn + 1, sizeof(struct pdec_t));
+    if (!pdec)
+      fatal("out of virtual memory");
+
+    for (i=0; i < num_insn; i++)
+      pdec_decode(&pdec[i], ld_text_base + i * sizeof(md_inst_t));
+
+    fprintf(stderr, "done\n");
+
+#ifdef USE_BB_CACHE
+    /* blocks are translated on first entry, at most one per text PC */
+    bb_max_recs = BB_POOL_FACTOR * num_insn + 2 * BB_MAX_INSN + 1;
+    bb_map = (struct bb_t **)calloc(num_insn + 1, sizeof(struct bb_t *));
+    bb_blocks = (struct bb_t *)calloc(num_insn + 1, sizeof(struct bb_t));
+    bb_recs = (struct bb_rec *)calloc(bb_max_recs, sizeof(struct bb_rec));
+    if (!bb_map || !bb_blocks || !bb_recs)
+      fatal("out of virtual memory");
+#endif /* USE_BB_CACHE */
+
+#ifdef USE_JIT
+    jit_cache = (unsigned char *)mmap(NULL, JIT_CACHE_SIZE,
+				      PROT_READ|PROT_WRITE|PROT_EXEC,
+				      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (jit_cache == (unsigned char *)MAP_FAILED)
+      fatal("cannot map the host code cache");
+#endif /* USE_JIT */
+  }
+#endif /* USE_PREDECODE */
 }
 
 /* print simulator-specific configuration information */
@@ -217,7 +1056,23 @@ sim_aux_stats(FILE *stream)
 void
 sim_uninit(void)
 {
-  /* nada */
+  if (bbv_on)
+    {
+      /* the last interval is written out, but too short to be clustered */
+      if (bbv_ntouched)
+	bbv_close(FALSE);
+      if (bbv_fd)
+	fclose(bbv_fd);
+      if (sp_name)
+	sp_write();
+      bbv_on = FALSE;
+    }
+
+  if (ckpt_every && ckpt_name)
+    {
+      ckpt_write_index();
+      ckpt_every = 0;
+    }
 }
 
 /*
@@ -282,24 +1137,776 @@ sim_uninit(void)
   ((FAULT) = md_fault_none, MEM_READ_QWORD(mem, (SRC)))
 #endif /* HOST_HAS_QWORD */
 
+#ifdef USE_PREDECODE
+/* a store into the text segment drops the predecoded instruction */
+#define PDEC_WRITE(DST)							\
+  ((md_addr_t)((DST) - ld_text_base) < ld_text_size			\
+   ? (void)(pdec[((DST) - ld_text_base) / sizeof(md_inst_t)].op = OP_NA, \
+	    text_written = TRUE)					\
+   : (void)0)
+#else /* !USE_PREDECODE */
+#define PDEC_WRITE(DST)		((void)0)
+#endif /* USE_PREDECODE */
+
+#ifdef USE_JIT
+/* log the memory a block writes while it is being checked */
+#define JIT_LOG_WRITE(DST, N)						\
+  (jit_logging ? jit_log_write((DST), (N)) : (void)0)
+#else /* !USE_JIT */
+#define JIT_LOG_WRITE(DST, N)	((void)0)
+#endif /* USE_JIT */
+
 #define WRITE_BYTE(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_BYTE(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, PDEC_WRITE(DST), JIT_LOG_WRITE(DST, 1),	\
+   MEM_WRITE_BYTE(mem, (DST), (SRC)))
 #define WRITE_HALF(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_HALF(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, PDEC_WRITE(DST), JIT_LOG_WRITE(DST, 2),	\
+   MEM_WRITE_HALF(mem, (DST), (SRC)))
 #define WRITE_WORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_WORD(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, PDEC_WRITE(DST), JIT_LOG_WRITE(DST, 4),	\
+   MEM_WRITE_WORD(mem, (DST), (SRC)))
 #ifdef HOST_HAS_QWORD
 #define WRITE_QWORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_QWORD(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, PDEC_WRITE(DST), JIT_LOG_WRITE(DST, 8),	\
+   MEM_WRITE_QWORD(mem, (DST), (SRC)))
 #endif /* HOST_HAS_QWORD */
 
 /* system call handler macro */
+#ifdef USE_PREDECODE
+#define SYSCALL(INST)	sys_syscall(&regs, pdec_mem_access, mem, INST, TRUE)
+#else /* !USE_PREDECODE */
 #define SYSCALL(INST)	sys_syscall(&regs, mem_access, mem, INST, TRUE)
+#endif /* USE_PREDECODE */
+
+#ifdef USE_PREDECODE
+/* operand fields come out of the predecoded record */
+#undef RS
+#define RS			(pd->rs)
+#undef RT
+#define RT			(pd->rt)
+#undef RD
+#define RD			(pd->rd)
+#undef IMM
+#define IMM			(pd->imm)
+
+/* point pd at the predecoded instruction at PC and load it, decoding it
+   again if its text was written, or on the fly outside the text segment */
+#define PDEC_FETCH(PC)							\
+  do {									\
+    if ((md_addr_t)((PC) - ld_text_base) < ld_text_size)		\
+      {									\
+	pd = pdec + ((PC) - ld_text_base) / sizeof(md_inst_t);		\
+	if (pd->op == OP_NA)						\
+	  pdec_decode(pd, (PC));					\
+      }									\
+    else								\
+      pdec_decode(pd = &pdec_tmp, (PC));				\
+    op = pd->op;							\
+    inst = pd->inst;							\
+  } while (0)
+#endif /* USE_PREDECODE */
+
+#ifdef USE_BB_CACHE
+/* output dependence designators of machine.def, as the GPR written or
+   -1, to find the instructions that may write $r0 */
+#define DNA			(-1)
+#define DGPR(N)			(N)
+#define DGPR_D(N)		(N)
+#define DCGPR(N)		(N)
+#define DFPR_L(N)		(-1)
+#define DFPR_F(N)		(-1)
+#define DFPR_D(N)		(-1)
+#define DHI			(-1)
+#define DLO			(-1)
+#define DFCC			(-1)
+#define DCPC			(-1)
+#define DNPC			(-1)
+
+/* drop every translated block */
+static void
+bb_flush(void)
+{
+  memset(bb_map, 0, (ld_text_size / sizeof(md_inst_t)) * sizeof(struct bb_t *));
+  bb_nblocks = 0;
+  bb_nrecs = 0;
+  text_written = FALSE;
+#ifdef USE_JIT
+  jit_used = 0;
+#endif /* USE_JIT */
+  bb_num_flush++;
+}
+
+/* translate the block entered at PC, in the text segment */
+static struct bb_t *
+bb_translate(md_addr_t PC)
+{
+  struct bb_t *bb = &bb_blocks[bb_nblocks++];
+  struct bb_rec *r, *rp, *first = &bb_recs[bb_nrecs];
+  struct pdec_t *pd;
+  unsigned int n = 0, flags;
+  int out1, out2;
+
+  bb->pc = PC;
+  bb->succ_pc[0] = bb->succ_pc[1] = 0;
+  bb->succ[0] = bb->succ[1] = NULL;
+  bb->rec = r = first;
+#ifdef USE_JIT
+  bb->hot = 0;
+  bb->jit = NULL;
+#endif /* USE_JIT */
+  do
+    {
+      pd = pdec + (PC - ld_text_base) / sizeof(md_inst_t);
+      if (pd->op == OP_NA)
+	pdec_decode(pd, PC);
+
+      switch (pd->op)
+	{
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+	case OP:							\
+	  flags = (FLAGS);						\
+	  out1 = O1;							\
+	  out2 = O2;							\
+	  break;
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
+#define CONNECT(OP)
+#include "machine.def"
+	default:
+	  /* a bogus or linking opcode, ends the block and panics if run */
+	  flags = F_TRAP;
+	  out1 = out2 = DNA;
+	  break;
+	}
+
+      r->handler = bb_handler[pd->op];
+      r->pc = PC;
+      r->rest = n++;
+      r->d = *pd;
+      r++;
+
+      /* sim_main() only zeroes $r0 on entry to a block */
+      if (out1 == MD_REG_ZERO || out2 == MD_REG_ZERO)
+	(r++)->handler = bb_handler[BB_ZERO];
+
+      PC += sizeof(md_inst_t);
+    }
+  while (!(flags & (F_CTRL|F_TRAP))
+	 && n < BB_MAX_INSN
+	 && (md_addr_t)(PC - ld_text_base) < ld_text_size);
+
+  /* count the instructions after each one, for a block left early */
+  for (rp = first; rp < r; rp++)
+    if (rp->handler != bb_handler[BB_ZERO])
+      rp->rest = n - 1 - rp->rest;
+
+  /* a block cut short falls through to PC */
+  r->handler = bb_handler[(flags & (F_CTRL|F_TRAP)) ? BB_EXIT : BB_CUT];
+  r->pc = PC;
+  bb->indirect = (flags & F_INDIRJMP) != 0;
+  bb->ninsn = n;
+  bb_nrecs += r + 1 - first;
+
+  bb_map[(bb->pc - ld_text_base) / sizeof(md_inst_t)] = bb;
+  bb_num_xlate++;
+  return bb;
+}
+
+/* the block entered at PC, translated if needed, or NULL outside the text
+   segment; a block FROM with direct successors only is chained to it */
+static struct bb_t *
+bb_find(md_addr_t PC, struct bb_t *from)
+{
+  struct bb_t *bb;
+
+  if ((md_addr_t)(PC - ld_text_base) >= ld_text_size)
+    return NULL;
+
+  if (text_written
+      || bb_nrecs + 2 * BB_MAX_INSN + 1 > bb_max_recs)
+    {
+      /* stale or full, FROM goes with the rest */
+      bb_flush();
+      from = NULL;
+    }
+
+  bb = bb_map[(PC - ld_text_base) / sizeof(md_inst_t)];
+  if (!bb)
+    bb = bb_translate(PC);
+
+  /* a branch has two successors and a fall through or trap one, so the
+     two slots never run out */
+  if (from && !from->indirect)
+    {
+      int i = from->succ[0] != NULL;
+
+      if (!from->succ[i])
+	{
+	  from->succ_pc[i] = PC;
+	  from->succ[i] = bb;
+	}
+    }
+  return bb;
+}
+
+#undef DNA
+#undef DGPR
+#undef DGPR_D
+#undef DCGPR
+#undef DFPR_L
+#undef DFPR_F
+#undef DFPR_D
+#undef DHI
+#undef DLO
+#undef DFCC
+#undef DCPC
+#undef DNPC
+#endif /* USE_BB_CACHE */
+
+#ifdef USE_JIT
+/* every non-control opcode of machine.def as a function, for the
+   instructions the compiled code does not do itself */
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+static void								\
+jit_op_##OP(struct pdec_t *pd)						\
+{									\
+  md_inst_t inst = pd->inst;						\
+									\
+  (void)inst;								\
+  SYMCAT(OP,_IMPL);							\
+}
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
+#define CONNECT(OP)
+#define DECLARE_FAULT(FAULT)						\
+	  { /* uncaught... */return; }
+#include "machine.def"
+#undef DECLARE_FAULT
+
+static void (*jit_op[/* max opcodes */])(struct pdec_t *) = {
+  NULL, /* NA */
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+  jit_op_##OP,
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
+  NULL,
+#define CONNECT(OP)
+#include "machine.def"
+};
+
+/* instruction flags of OP */
+static unsigned int
+jit_flags(enum md_opcode op)
+{
+  switch (op)
+    {
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+    case OP:								\
+      return (FLAGS);
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
+#define CONNECT(OP)
+#include "machine.def"
+    default:
+      return 0;
+    }
+}
+
+/* host has the POPCNT instruction */
+static int jit_popcnt = -1;
+
+/* offsets of the architected state from struct regs_t */
+#define JIT_GPR(N)	((int)(offsetof(struct regs_t, regs_R)		\
+			       + (N) * sizeof(regs.regs_R[0])))
+#define JIT_HI		((int)offsetof(struct regs_t, regs_C.hi))
+#define JIT_LO		((int)offsetof(struct regs_t, regs_C.lo))
+#define JIT_PC		((int)offsetof(struct regs_t, regs_PC))
+#define JIT_NPC		((int)offsetof(struct regs_t, regs_NPC))
+
+/* x86-64 registers used, %rbx holds the struct regs_t pointer */
+#define JIT_EAX		0
+#define JIT_ECX		1
+
+/* next byte of host code */
+static unsigned char *jp;
+
+static void
+jit_b(int b)
+{
+  *jp++ = (unsigned char)b;
+}
+
+static void
+jit_w(word_t w)
+{
+  memcpy(jp, &w, sizeof(w));
+  jp += sizeof(w);
+}
+
+static void
+jit_q(void *p)
+{
+  memcpy(jp, &p, sizeof(p));
+  jp += sizeof(p);
+}
+
+/* OPC reg, DISP(%rbx) */
+static void
+jit_rm(int opc, int reg, int disp)
+{
+  jit_b(opc);
+  jit_b(0x83 | (reg << 3));
+  jit_w(disp);
+}
+
+/* movl $IMM, DISP(%rbx) */
+static void
+jit_set(int disp, word_t imm)
+{
+  jit_b(0xc7);
+  jit_b(0x83);
+  jit_w(disp);
+  jit_w(imm);
+}
+
+/* load GPR N into reg */
+static void
+jit_get_gpr(int reg, int n)
+{
+  if (n == MD_REG_ZERO)
+    {
+      /* xorl reg, reg */
+      jit_b(0x31);
+      jit_b(0xc0 | (reg << 3) | reg);
+    }
+  else
+    jit_rm(0x8b, reg, JIT_GPR(n));
+}
+
+/* store %eax to GPR N, writes to $r0 are dropped */
+static void
+jit_put_gpr(int n)
+{
+  if (n != MD_REG_ZERO)
+    jit_rm(0x89, JIT_EAX, JIT_GPR(n));
+}
+
+/* OPC %ecx, %eax */
+static void
+jit_alu(int opc)
+{
+  jit_b(opc);
+  jit_b(0xc8);
+}
+
+/* OPC $IMM, %eax */
+static void
+jit_alu_imm(int opc, word_t imm)
+{
+  jit_b(opc);
+  jit_w(imm);
+}
+
+/* setCC %al; movzbl %al, %eax */
+static void
+jit_setcc(int cc)
+{
+  jit_b(0x0f);
+  jit_b(0x90 | cc);
+  jit_b(0xc0);
+  jit_b(0x0f);
+  jit_b(0xb6);
+  jit_b(0xc0);
+}
+
+/* set NPC to TARGET if condition CC holds, to PC + 8 otherwise */
+static void
+jit_branch(int cc, md_addr_t PC, md_addr_t target)
+{
+  /* movl $PC+8, %ecx; movl $target, %edx; cmovCC %edx, %ecx */
+  jit_b(0xb9);
+  jit_w(PC + sizeof(md_inst_t));
+  jit_b(0xba);
+  jit_w(target);
+  jit_b(0x0f);
+  jit_b(0x40 | cc);
+  jit_b(0xca);
+  jit_rm(0x89, JIT_ECX, JIT_NPC);
+}
+
+/* x86 condition codes */
+#define JIT_CC_B	0x2
+#define JIT_CC_E	0x4
+#define JIT_CC_NE	0x5
+#define JIT_CC_L	0xc
+#define JIT_CC_GE	0xd
+#define JIT_CC_LE	0xe
+#define JIT_CC_G	0xf
+
+/* compile BB to host code, leaves it interpreted if one of its
+   instructions cannot be compiled */
+static void
+jit_translate(struct bb_t *bb)
+{
+  struct bb_rec *r;
+  struct pdec_t *pd;
+  md_inst_t inst;
+  unsigned int flags;
+  unsigned char *code;
+
+  if (jit_popcnt < 0)
+    jit_popcnt = __builtin_cpu_supports("popcnt");
+
+  /* system calls, linking opcodes and jumps other than the integer
+     branches, j, jal and jr stay in the interpreter */
+  for (r = bb->rec; r->handler != bb_handler[BB_EXIT]
+	 && r->handler != bb_handler[BB_CUT]; r++)
+    {
+      if (r->handler == bb_handler[BB_ZERO])
+	continue;
+      flags = jit_flags(r->d.op);
+      if (!jit_op[r->d.op] || (flags & F_TRAP))
+	return;
+      if ((flags & F_CTRL)
+	  && r->d.op != JUMP && r->d.op != JAL && r->d.op != JR
+	  && r->d.op != BEQ && r->d.op != BNE && r->d.op != BLEZ
+	  && r->d.op != BGTZ && r->d.op != BLTZ && r->d.op != BGEZ)
+	return;
+    }
+  if (jit_used + JIT_MAX_CODE > JIT_CACHE_SIZE)
+    return;
+
+  code = jp = jit_cache + jit_used;
+
+  /* pushq %rbx; movq %rdi, %rbx */
+  jit_b(0x53);
+  jit_b(0x48);
+  jit_b(0x89);
+  jit_b(0xfb);
+
+  for (r = bb->rec; ; r++)
+    {
+      if (r->handler == bb_handler[BB_ZERO])
+	{
+	  /* the function before may have written $r0 */
+	  jit_set(JIT_GPR(MD_REG_ZERO), 0);
+	  continue;
+	}
+      if (r->handler == bb_handler[BB_CUT])
+	jit_set(JIT_NPC, r->pc);
+      if (r->handler == bb_handler[BB_EXIT]
+	  || r->handler == bb_handler[BB_CUT])
+	break;
+
+      pd = &r->d;
+      inst = pd->inst;
+      flags = jit_flags(pd->op);
+      if (flags & F_CTRL)
+	jit_set(JIT_PC, r->pc);
+
+      switch (pd->op)
+	{
+	case NOP:
+	  break;
+
+	case ADDU:
+	case SUBU:
+	case AND_:
+	case OR:
+	case XOR:
+	case NOR:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_get_gpr(JIT_ECX, RT);
+	  jit_alu(pd->op == ADDU ? 0x01
+		  : pd->op == SUBU ? 0x29
+		  : pd->op == AND_ ? 0x21
+		  : pd->op == XOR ? 0x31 : 0x09);
+	  if (pd->op == NOR)
+	    {
+	      /* notl %eax */
+	      jit_b(0xf7);
+	      jit_b(0xd0);
+	    }
+	  jit_put_gpr(RD);
+	  break;
+
+	case ADDIU:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_alu_imm(0x05, IMM);
+	  jit_put_gpr(RT);
+	  break;
+
+	case ANDI:
+	case ORI:
+	case XORI:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_alu_imm(pd->op == ANDI ? 0x25 : pd->op == ORI ? 0x0d : 0x35,
+		      UIMM);
+	  jit_put_gpr(RT);
+	  break;
+
+	case LUI:
+	  /* movl $imm, %eax */
+	  jit_b(0xb8);
+	  jit_w(UIMM << 16);
+	  jit_put_gpr(RT);
+	  break;
+
+	case SLL:
+	case SRL:
+	case SRA:
+	  if (SHAMT >= 32)
+	    goto call;
+	  jit_get_gpr(JIT_EAX, RT);
+	  if (SHAMT)
+	    {
+	      /* shll/shrl/sarl $shamt, %eax */
+	      jit_b(0xc1);
+	      jit_b(pd->op == SLL ? 0xe0 : pd->op == SRL ? 0xe8 : 0xf8);
+	      jit_b(SHAMT);
+	    }
+	  jit_put_gpr(RD);
+	  break;
+
+	case SLLV:
+	case SRLV:
+	case SRAV:
+	  /* the host masks the shift count to 5 bits too */
+	  jit_get_gpr(JIT_EAX, RT);
+	  jit_get_gpr(JIT_ECX, RS);
+	  jit_b(0xd3);
+	  jit_b(pd->op == SLLV ? 0xe0 : pd->op == SRLV ? 0xe8 : 0xf8);
+	  jit_put_gpr(RD);
+	  break;
+
+	case SLT:
+	case SLTU:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_get_gpr(JIT_ECX, RT);
+	  jit_alu(0x39);
+	  jit_setcc(pd->op == SLT ? JIT_CC_L : JIT_CC_B);
+	  jit_put_gpr(RD);
+	  break;
+
+	case SLTI:
+	case SLTIU:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_alu_imm(0x3d, IMM);
+	  jit_setcc(pd->op == SLTI ? JIT_CC_L : JIT_CC_B);
+	  jit_put_gpr(RT);
+	  break;
+
+	case BITCOUNT:
+	  if (!jit_popcnt)
+	    goto call;
+	  jit_get_gpr(JIT_EAX, RS);
+	  /* popcntl %eax, %eax */
+	  jit_b(0xf3);
+	  jit_b(0x0f);
+	  jit_b(0xb8);
+	  jit_b(0xc0);
+	  if (!UIMM)
+	    {
+	      /* negl %eax; addl $32, %eax */
+	      jit_b(0xf7);
+	      jit_b(0xd8);
+	      jit_b(0x83);
+	      jit_b(0xc0);
+	      jit_b(32);
+	    }
+	  jit_put_gpr(RT);
+	  break;
+
+	case MULTU:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_get_gpr(JIT_ECX, RT);
+	  /* mull %ecx */
+	  jit_b(0xf7);
+	  jit_b(0xe1);
+	  jit_rm(0x89, JIT_EAX, JIT_LO);
+	  jit_rm(0x89, 2 /* %edx */, JIT_HI);
+	  break;
+
+	case MFHI:
+	case MFLO:
+	  jit_rm(0x8b, JIT_EAX, pd->op == MFHI ? JIT_HI : JIT_LO);
+	  jit_put_gpr(RD);
+	  break;
+
+	case MTHI:
+	case MTLO:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_rm(0x89, JIT_EAX, pd->op == MTHI ? JIT_HI : JIT_LO);
+	  break;
+
+	case JUMP:
+	case JAL:
+	  jit_set(JIT_NPC, (r->pc & 036000000000) | (TARG << 2));
+	  if (pd->op == JAL)
+	    jit_set(JIT_GPR(31), r->pc + 8);
+	  break;
+
+	case JR:
+	  /* a misaligned target faults, leaving NPC at PC + 8:
+	     movl $PC+8, %ecx; testl $7, %eax; cmovzl %eax, %ecx */
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_b(0xb9);
+	  jit_w(r->pc + sizeof(md_inst_t));
+	  jit_alu_imm(0xa9, 7);
+	  jit_b(0x0f);
+	  jit_b(0x44);
+	  jit_b(0xc8);
+	  jit_rm(0x89, JIT_ECX, JIT_NPC);
+	  break;
+
+	case BEQ:
+	case BNE:
+	  jit_get_gpr(JIT_EAX, RS);
+	  jit_get_gpr(JIT_ECX, RT);
+	  jit_alu(0x39);
+	  jit_branch(pd->op == BEQ ? JIT_CC_E : JIT_CC_NE,
+		     r->pc, r->pc + 8 + (OFS << 2));
+	  break;
+
+	case BLEZ:
+	case BGTZ:
+	case BLTZ:
+	case BGEZ:
+	  jit_get_gpr(JIT_EAX, RS);
+	  /* testl %eax, %eax */
+	  jit_b(0x85);
+	  jit_b(0xc0);
+	  jit_branch(pd->op == BLEZ ? JIT_CC_LE
+		     : pd->op == BGTZ ? JIT_CC_G
+		     : pd->op == BLTZ ? JIT_CC_L : JIT_CC_GE,
+		     r->pc, r->pc + 8 + (OFS << 2));
+	  break;
+
+	default:
+	call:
+	  /* movabsq $pd, %rdi; movabsq $jit_op_OP, %rax; call *%rax */
+	  jit_b(0x48);
+	  jit_b(0xbf);
+	  jit_q(pd);
+	  jit_b(0x48);
+	  jit_b(0xb8);
+	  jit_q((void *)jit_op[pd->op]);
+	  jit_b(0xff);
+	  jit_b(0xd0);
+
+	  if (flags & F_STORE)
+	    {
+	      /* leave if the store wrote the text segment:
+		 movabsq $text_written, %rax; cmpl $0, (%rax); je 1f;
+		 movl $PC+8, NPC(%rbx); movl $rest, %eax; popq %rbx; ret; 1: */
+	      jit_b(0x48);
+	      jit_b(0xb8);
+	      jit_q(&text_written);
+	      jit_b(0x83);
+	      jit_b(0x38);
+	      jit_b(0x00);
+	      jit_b(0x74);
+	      jit_b(17);
+	      jit_set(JIT_NPC, r->pc + sizeof(md_inst_t));
+	      jit_b(0xb8);
+	      jit_w(r->rest);
+	      jit_b(0x5b);
+	      jit_b(0xc3);
+	    }
+	  break;
+	}
+    }
+
+  /* xorl %eax, %eax; popq %rbx; ret */
+  jit_b(0x31);
+  jit_b(0xc0);
+  jit_b(0x5b);
+  jit_b(0xc3);
+
+  jit_used = jp - jit_cache;
+  bb->jit = (unsigned int (*)(struct regs_t *))code;
+  jit_num_xlate++;
+}
+
+/* remember the bytes at [ADDR, ADDR + NBYTES) before a checked block
+   writes them */
+static void
+jit_log_write(md_addr_t addr, int nbytes)
+{
+  struct jit_write *w;
+  int i;
+
+  if (jit_nlog == JIT_LOG_SIZE)
+    fatal("jit: too many writes in one block");
+  w = &jit_log[jit_nlog++];
+  w->addr = addr;
+  w->nbytes = nbytes;
+  for (i = 0; i < nbytes; i++)
+    w->old[i] = MEM_READ_BYTE(mem, addr + i);
+}
+
+/* state the checked block started from */
+static struct regs_t jit_regs_in;
+
+/* start checking a block, the interpreter runs it first */
+static void
+jit_check_begin(void)
+{
+  jit_regs_in = regs;
+  jit_nlog = 0;
+  jit_logging = TRUE;
+}
+
+/* the interpreter ran BB, leaving REST instructions unrun: roll its
+   writes back, run the host code of BB from the same state and stop at
+   any difference, returns the instructions the host code left unrun */
+static unsigned int
+jit_check_end(struct bb_t *bb, unsigned int rest)
+{
+  static byte_t val[JIT_LOG_SIZE][8];
+  struct regs_t expect = regs;
+  int written = text_written, nlog = jit_nlog, i, j;
+  unsigned int jit_rest;
+
+  jit_logging = FALSE;
+  for (i = 0; i < nlog; i++)
+    for (j = 0; j < jit_log[i].nbytes; j++)
+      val[i][j] = MEM_READ_BYTE(mem, jit_log[i].addr + j);
+  for (i = nlog - 1; i >= 0; i--)
+    for (j = 0; j < jit_log[i].nbytes; j++)
+      MEM_WRITE_BYTE(mem, jit_log[i].addr + j, jit_log[i].old[j]);
+
+  regs = jit_regs_in;
+  text_written = FALSE;
+  jit_rest = bb->jit(&regs);
+
+  for (i = 0; i < MD_NUM_IREGS; i++)
+    if (regs.regs_R[i] != expect.regs_R[i])
+      fatal("jit: block at 0x%08x sets r%d to 0x%08x, "
+	    "the interpreter to 0x%08x", bb->pc, i,
+	    (word_t)regs.regs_R[i], (word_t)expect.regs_R[i]);
+  if (regs.regs_NPC != expect.regs_NPC)
+    fatal("jit: block at 0x%08x goes to 0x%08x, the interpreter to 0x%08x",
+	  bb->pc, regs.regs_NPC, expect.regs_NPC);
+  if (jit_rest != rest || memcmp(&regs, &expect, sizeof(regs)))
+    fatal("jit: block at 0x%08x ends in a state other than the "
+	  "interpreter's", bb->pc);
+  for (i = 0; i < nlog; i++)
+    for (j = 0; j < jit_log[i].nbytes; j++)
+      if (MEM_READ_BYTE(mem, jit_log[i].addr + j) != val[i][j])
+	fatal("jit: block at 0x%08x writes 0x%02x at 0x%08x, "
+	      "the interpreter 0x%02x", bb->pc,
+	      MEM_READ_BYTE(mem, jit_log[i].addr + j),
+	      jit_log[i].addr + j, val[i][j]);
+
+  text_written |= written;
+  jit_num_checked++;
+  return jit_rest;
+}
+#endif /* USE_JIT */
 
 #ifndef NO_INSN_COUNT
 #define INC_INSN_CTR()	sim_num_insn++
+#define ADD_INSN_CTR(N)	(sim_num_insn += (N))
 #else /* !NO_INSN_COUNT */
 #define INC_INSN_CTR()	/* nada */
+#define ADD_INSN_CTR(N)	/* nada */
 #endif /* NO_INSN_COUNT */
 
 #ifdef TARGET_ALPHA
@@ -308,6 +1915,22 @@ sim_uninit(void)
 #define ZERO_FP_REG()	/* nada... */
 #endif
 
+#ifdef USE_BB_CACHE
+/* the blocks are profiled as they are entered, an instruction run on its
+   own counts as a block of one */
+#define BBV_INSN(FLAGS)							\
+  if (bbv_on) bbv_count(regs.regs_PC, sim_num_insn - 1, 1)
+#else /* !USE_BB_CACHE */
+/* a control instruction ends the block being profiled */
+#define BBV_INSN(FLAGS)							\
+  if (((FLAGS) & F_CTRL) && bbv_on) bbv_ctrl()
+#endif /* USE_BB_CACHE */
+
+/* write the checkpoint once the instruction count reaches it, the next
+   instruction to run being at PC */
+#define CKPT_CHECK(PC)							\
+  if (sim_num_insn == ckpt_next) ckpt_take(PC)
+
 /* start simulation, program loaded, processor precise state initialized */
 void
 sim_main(void)
@@ -331,6 +1954,33 @@ sim_main(void)
 #define CONNECT(OP)
 #include "machine.def"
   };
+
+#ifdef USE_BB_CACHE
+  /* block jump table, the implementation of each opcode inside a
+     translated block, then the block pseudo instructions */
+  static void *bb_jump[/* max opcodes + pseudo instructions */] = {
+    &&bb_NA, /* NA */
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+    &&bb_##OP,
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
+    &&bb_##OP,
+#define CONNECT(OP)
+#include "machine.def"
+    &&bb_zero, /* BB_ZERO */
+    &&bb_exit, /* BB_EXIT */
+    &&bb_cut /* BB_CUT */
+  };
+
+  /* block being run, and its instruction being run */
+  register struct bb_t *bb;
+  register struct bb_rec *ip = NULL;
+#endif /* USE_BB_CACHE */
+
+#ifdef USE_JIT
+  /* instructions the block left unrun, checking a compiled block */
+  unsigned int rest;
+  int checking = FALSE;
+#endif /* USE_JIT */
 #endif /* USE_JUMP_TABLE */
 
   /* register allocate instruction buffer */
@@ -339,25 +1989,68 @@ sim_main(void)
   /* decoded opcode */
   register enum md_opcode op;
 
+#ifdef USE_PREDECODE
+  /* predecoded instruction */
+  register struct pdec_t *pd = NULL;
+#endif /* USE_PREDECODE */
+
   fprintf(stderr, "sim: ** starting *fast* functional simulation **\n");
 
   /* must have natural byte/word ordering */
   if (sim_swap_bytes || sim_swap_words)
     fatal("sim: *fast* functional simulation cannot swap bytes or words");
 
+#ifndef USE_BB_CACHE
+  /* the first block is entered at the program entry */
+  bbv_pc = regs.regs_PC;
+#endif /* !USE_BB_CACHE */
+
 #ifdef USE_JUMP_TABLE
 
   regs.regs_NPC = regs.regs_PC;
 
+#ifdef USE_BB_CACHE
+  /* run the first block */
+  bb_handler = bb_jump;
+  goto bb_enter;
+#else /* !USE_BB_CACHE */
   /* load instruction */
+#ifdef USE_PREDECODE
+  PDEC_FETCH(regs.regs_NPC);
+#else /* !USE_PREDECODE */
   MD_FETCH_INST(inst, mem, regs.regs_NPC);
 
   /* jump to instruction implementation */
   MD_SET_OPCODE(op, inst);
+#endif /* USE_PREDECODE */
   goto *op_jump[op];
+#endif /* USE_BB_CACHE */
+
+#ifdef USE_PREDECODE
+#define NEXT_INST(PC)		PDEC_FETCH(PC)
+#else /* !USE_PREDECODE */
+#define NEXT_INST(PC)							\
+  do {									\
+    MD_FETCH_INST(inst, mem, (PC));					\
+    MD_SET_OPCODE(op, inst);						\
+  } while (0)
+#endif /* USE_PREDECODE */
+
+#ifdef USE_BB_CACHE
+/* an instruction run on its own goes back to the blocks */
+#define DISPATCH_NEXT()		goto bb_enter
+#else /* !USE_BB_CACHE */
+#define DISPATCH_NEXT()							\
+  do {									\
+    NEXT_INST(regs.regs_NPC);						\
+    goto *op_jump[op];							\
+  } while (0)
+#endif /* USE_BB_CACHE */
 
 #define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
   opcode_##OP:								\
+    CKPT_CHECK(regs.regs_NPC);						\
+									\
     /* maintain $r0 semantics */					\
     regs.regs_R[MD_REG_ZERO] = 0;					\
     ZERO_FP_REG();							\
@@ -373,25 +2066,175 @@ sim_main(void)
 									\
     /* execute the instruction */					\
     SYMCAT(OP,_IMPL);							\
+    BBV_INSN(FLAGS);							\
 									\
-    /* get the next instruction */					\
-    MD_FETCH_INST(inst, mem, regs.regs_NPC);				\
-									\
-    /* jump to instruction implementation */				\
-    MD_SET_OPCODE(op, inst);						\
-    goto *op_jump[op];
+    /* get the next instruction and jump to its implementation */	\
+    DISPATCH_NEXT();
 
 #define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
   opcode_##OP:								\
     panic("attempted to execute a linking opcode");
 #define CONNECT(OP)
 #define DECLARE_FAULT(FAULT)						\
-	  { /* uncaught... */break; }
+	  { /* uncaught... */goto fault_next; }
 #include "machine.def"
+#undef DECLARE_FAULT
+
+  fault_next:
+    /* an uncaught fault skips the rest of the instruction, as the break
+       out of the switch does below */
+    DISPATCH_NEXT();
 
   opcode_NA:
     panic("attempted to execute a bogus opcode");
 
+#ifdef USE_BB_CACHE
+  bb_enter:
+    /* find the block at NPC, outside the text segment run the instruction
+       there on its own */
+    bb = bb_find(regs.regs_NPC, NULL);
+    if (!bb)
+      {
+	PDEC_FETCH(regs.regs_NPC);
+	goto *op_jump[op];
+      }
+
+  bb_run:
+    /* a block running past the checkpoint is run an instruction at a
+       time up to it */
+    CKPT_CHECK(regs.regs_NPC);
+    if (sim_num_insn + bb->ninsn > ckpt_next)
+      {
+	PDEC_FETCH(regs.regs_NPC);
+	goto *op_jump[op];
+      }
+
+    /* count the whole block up front, $r0 semantics are kept by BB_ZERO
+       after the instructions that may write it */
+    if (bbv_on)
+      bbv_count(bb->pc, sim_num_insn, bb->ninsn);
+    ADD_INSN_CTR(bb->ninsn);
+    regs.regs_R[MD_REG_ZERO] = 0;
+#ifdef USE_JIT
+    if (bb->jit)
+      {
+	if (!jit_check)
+	  {
+	    rest = bb->jit(&regs);
+	    goto jit_done;
+	  }
+
+	/* interpret the block first, then compare the host code to it */
+	jit_check_begin();
+	checking = TRUE;
+      }
+    else if (++bb->hot == (unsigned int)jit_hot)
+      jit_translate(bb);
+#endif /* USE_JIT */
+    ip = bb->rec;
+    goto *ip->handler;
+
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+  bb_##OP:								\
+    /* only control and trap instructions look at their PC */		\
+    if ((FLAGS) & (F_CTRL|F_TRAP))					\
+      {									\
+	regs.regs_PC = ip->pc;						\
+	regs.regs_NPC = ip->pc + sizeof(md_inst_t);			\
+      }									\
+    pd = &ip->d;							\
+    inst = pd->inst;							\
+									\
+    /* execute the instruction */					\
+    SYMCAT(OP,_IMPL);							\
+									\
+    /* leave a block whose text was just written */			\
+    if (((FLAGS) & (F_STORE|F_TRAP)) && text_written)			\
+      goto bb_abort;							\
+									\
+    /* jump to the next instruction of the block */			\
+    ip++;								\
+    goto *ip->handler;
+
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
+  bb_##OP:								\
+    panic("attempted to execute a linking opcode");
+#define CONNECT(OP)
+#define DECLARE_FAULT(FAULT)						\
+	  { /* uncaught... */goto bb_fault; }
+#include "machine.def"
+#undef DECLARE_FAULT
+
+  bb_fault:
+    /* an uncaught fault skips the rest of the instruction */
+    ip++;
+    goto *ip->handler;
+
+  bb_zero:
+    /* the instruction before may have written $r0 */
+    regs.regs_R[MD_REG_ZERO] = 0;
+    ip++;
+    goto *ip->handler;
+
+  bb_cut:
+    /* a block cut short falls through */
+    regs.regs_NPC = ip->pc;
+
+  bb_exit:
+#ifdef USE_JIT
+    if (checking)
+      {
+	rest = 0;
+	goto jit_check;
+      }
+  bb_chain:
+#endif /* USE_JIT */
+    /* follow the chain to the successor at NPC, looking it up and
+       chaining it the first time */
+    if (regs.regs_NPC == bb->succ_pc[0] && bb->succ[0])
+      bb = bb->succ[0];
+    else if (regs.regs_NPC == bb->succ_pc[1] && bb->succ[1])
+      bb = bb->succ[1];
+    else if (!(bb = bb_find(regs.regs_NPC, bb)))
+      {
+	PDEC_FETCH(regs.regs_NPC);
+	goto *op_jump[op];
+      }
+    goto bb_run;
+
+  bb_abort:
+    /* the rest of the block may be stale, uncount it and go on from the
+       next instruction, bb_find() drops all blocks */
+    regs.regs_NPC = ip->pc + sizeof(md_inst_t);
+#ifdef USE_JIT
+    if (checking)
+      {
+	rest = ip->rest;
+	goto jit_check;
+      }
+#endif /* USE_JIT */
+    ADD_INSN_CTR(-(counter_t)ip->rest);
+    goto bb_enter;
+
+#ifdef USE_JIT
+  jit_check:
+    checking = FALSE;
+    rest = jit_check_end(bb, rest);
+
+  jit_done:
+    /* compiled code leaves a block whose text it wrote, like bb_abort */
+    if (text_written)
+      {
+	ADD_INSN_CTR(-(counter_t)rest);
+	goto bb_enter;
+      }
+    goto bb_chain;
+#endif /* USE_JIT */
+
+  bb_NA:
+    panic("attempted to execute a bogus opcode");
+#endif /* USE_BB_CACHE */
+
   /* should not get here... */
   panic("exited sim-fast main loop");
 
@@ -408,6 +2251,8 @@ sim_main(void)
       regs.regs_F.d[MD_REG_ZERO] = 0.0;
 #endif /* TARGET_ALPHA */
 
+      CKPT_CHECK(regs.regs_PC);
+
       /* keep an instruction count */
 #ifndef NO_INSN_COUNT
       sim_num_insn++;
@@ -418,7 +2263,10 @@ sim_main(void)
       op = (enum md_opcode)__UNCHK_MEM_READ(dec, regs.regs_PC << 1, word_t);
       inst =
 	__UNCHK_MEM_READ(dec, (regs.regs_PC << 1)+sizeof(word_t), md_inst_t);
-#else /* !TARGET_ALPHA */
+#elif defined(USE_PREDECODE)
+      /* load predecoded instruction */
+      PDEC_FETCH(regs.regs_PC);
+#else /* !TARGET_ALPHA && !USE_PREDECODE */
       /* load instruction */
       MD_FETCH_INST(inst, mem, regs.regs_PC);
 
@@ -432,6 +2280,7 @@ sim_main(void)
 #define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
 	case OP:							\
 	  SYMCAT(OP,_IMPL);						\
+	  BBV_INSN(FLAGS);						\
 	  break;
 #define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
 	case OP:							\
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* bench-cache: times the lookups of the cache of sim-pipe as it was before
+   and after its sets became flat arrays, outside the simulator.  The cache
+   code of both versions is kept here, on a flat array standing in for the
+   memory of the program, and picked at build time:
+
+     $ gcc -O2 -DLINKED_LIST_SETS -o bench-cache-list bench-cache.c
+     $ gcc -O2 -o bench-cache bench-cache.c
+     $ ./bench-cache-list && ./bench-cache
+
+   Each of the two address streams is replayed 5 times into an empty
+   cache.  The speed of the best run is printed, with the counters, which
+   must be the same for both builds. */
+
+typedef unsigned int word_t;
+typedef unsigned int md_addr_t;
+
+/* the memory of the program, 4 MB wrapped around; it never faults, so the
+   stand-ins of READ_WORD and WRITE_WORD take no fault variable */
+#define MEM_WORDS (1 << 20)
+static word_t memory[MEM_WORDS];
+#define READ_WORD(A) (memory[((A) >> 2) & (MEM_WORDS - 1)])
+#define WRITE_WORD(S, A) (memory[((A) >> 2) & (MEM_WORDS - 1)] = (S))
+
+static void fatal(const char* s) {
+  fprintf(stderr, "fatal: %s\n", s);
+  exit(1);
+}
+
+#define SET_WAYS 4     /* 4-way set-associative cache */
+#define SET_NUM 16     /* the cache has 16 sets */
+#define LINE_WORDS 4     /* a cache line holds 4 words (16 bytes) */
+#define HIT_LATENCY 1     /* cache hit latency is 1 cycle */
+#define MISS_LATENCY 10     /* cache miss latency is 10 cycle */
+#define ADDR_TAG(ADDR) (((unsigned int) ADDR) >> 8)     /* get tag bits */
+#define ADDR_IDX(ADDR) ((((unsigned int) ADDR) & 0xF0) >> 4)      /* get index bits */
+#define ADDR_OFFSET(ADDR) ((((unsigned int) ADDR) & 0xF))       /* get offset bits */
+
+#ifdef LINKED_LIST_SETS
+
+/* before: every set is a queue of lines allocated on a miss */
+
+#define ENGINE "linked-list sets"
+
+struct cache_line {
+  unsigned int data[4];             /* 16 bytes */
+  unsigned int tag:27;              /* tag bits of the line */
+  unsigned int dirty:1;             /* if the line is dirty */
+  unsigned int valid:1;             /* if the line is valid */
+  unsigned int ref_count:19;        /* times the line has been referred */
+  struct cache_line* next;          /* pointer to the next line */
+};
+
+struct cache_set {
+  struct cache_line* head;          /* the head of the queue */
+  struct cache_line* tail;          /* the tail of the queue */
+  unsigned int n;                   /* the number of lines in the queue */
+};
+
+struct cache {
+  struct cache_set sets[16];        /* 16 sets */
+  unsigned int isEnabled;           /* if the cache is enabled */
+  unsigned int accessCounter;       /* times of cache access */
+  unsigned int hitCounter;          /* times of cache hit */
+  unsigned int missCounter;         /* times of cache miss */
+  unsigned int replaceCounter;      /* times of cache line replacement */
+  unsigned int wbCounter;           /* times of write back */
+};
+
+typedef void (*cache_func)(struct cache_line*, unsigned int, word_t*);
+
+struct cache cache;
+
+static void add_cache_line(struct cache_set*, unsigned int, struct cache_line*);
+
+/* empty the cache and reset the counters */
+static void cache_init() {
+  struct cache_set* sp;
+  struct cache_line* lp;
+  int i;
+  for (i = 0; i < SET_NUM; ++i) {
+    sp = &cache.sets[i];
+    while (sp->head != NULL) {
+      lp = sp->head;
+      sp->head = lp->next;
+      free(lp);
+    }
+  }
+  memset(&cache, 0, sizeof(cache));
+  cache.isEnabled = 1;
+}
+
+static void enque_cache_set(struct cache_set* sp, struct cache_line* lp) {
+  if (sp->tail != NULL) {
+    sp->tail->next = lp;
+  }
+  sp->tail = lp;
+  if (sp->head == NULL) {
+    sp->head = lp;
+  }
+  ++sp->n;
+}
+
+static void deque_cache_set(struct cache_set* sp) {
+  if (sp->n == 0) {
+    return;
+  }
+  struct cache_line* head = sp->head;
+  sp->head = sp->head->next;
+  --sp->n;
+  if (sp->n == 0) {
+    sp->tail = NULL;
+  }
+  free(head);
+}
+
+static void cache_do_read(struct cache_line* lp, unsigned int offset, word_t* dst) {
+  memcpy(dst, (char *)(&lp->data)+offset, sizeof(word_t));
+}
+
+static void cache_do_write(struct cache_line* lp, unsigned int offset, word_t* src) {
+  memcpy((char *)(&lp->data)+offset, src, sizeof(word_t));
+  lp->dirty = 1;
+}
+
+static struct cache_line* malloc_cache_line(md_addr_t addr) {
+  struct cache_line* lp = malloc(sizeof(struct cache_line));
+  int i;
+  if (!lp)
+    fatal("out of virtual memory");
+  for (i = 0; i < SET_WAYS; ++i) {
+    lp->data[i] = READ_WORD(addr + (i * 4));
+  }
+  lp->ref_count = 0;
+  lp->tag = ADDR_TAG(addr);
+  lp->valid = 1;
+  lp->dirty = 0;
+  lp->next = NULL;
+  return lp;
+}
+
+static unsigned int cache_access(struct cache* cp, md_addr_t addr, word_t* wp, cache_func func) {
+  unsigned int tag = ADDR_TAG(addr);
+  unsigned int idx = ADDR_IDX(addr);
+  unsigned int offset = ADDR_OFFSET(addr);
+
+  struct cache_set* sp = &cp->sets[idx];
+  struct cache_line* lp = NULL;
+  md_addr_t align_addr = addr & (~0xF);
+
+  unsigned int cycles = HIT_LATENCY;
+  unsigned int miss = 1;
+  ++cp->accessCounter;
+
+  for (lp = sp->head; lp != NULL; lp = lp->next) {
+    if (lp->valid && tag == lp->tag) {
+      miss = 0;
+      ++lp->ref_count;
+      ++cp->hitCounter;
+      func(lp, offset, wp);
+      break;
+    }
+  }
+
+  if (miss) {
+    cycles = MISS_LATENCY;
+    ++cp->missCounter;
+    lp = malloc_cache_line(align_addr);
+    add_cache_line(sp, idx, lp);
+    func(lp, offset, wp);
+  }
+  return cycles;
+}
+
+static unsigned int cache_read(struct cache* cp, md_addr_t addr, word_t* wp) {
+  return cache_access(cp, addr, wp, cache_do_read);
+}
+
+static unsigned int cache_write(struct cache* cp, md_addr_t addr, word_t* wp) {
+  return cache_access(cp, addr, wp, cache_do_write);
+}
+
+static void cache_write_back(struct cache_line* lp, unsigned int idx) {
+  md_addr_t addr = (lp->tag << 8) | (idx << 4);
+  int i;
+  for (i = 0; i < SET_WAYS; ++i) {
+    WRITE_WORD(lp->data[i], addr + (i * 4));
+  }
+  lp->dirty = 0;
+}
+
+static void add_cache_line(struct cache_set* sp, unsigned int idx, struct cache_line* lp) {
+  if (sp->n >= SET_WAYS) {
+    if (sp->head->dirty) {
+      ++cache.wbCounter;
+      cache_write_back(sp->head, idx);
+    }
+    ++cache.replaceCounter;
+    deque_cache_set(sp);
+  }
+  enque_cache_set(sp, lp);
+}
+
+#else /* !LINKED_LIST_SETS */
+
+/* after: the lines of all sets live in arrays allocated once */
+
+#define ENGINE "flat arrays"
+
+/* index of a (set, way) pair into the flat line arrays */
+#define LINE_IDX(IDX, WAY) ((IDX) * SET_WAYS + (WAY))
+/* valid/dirty mask with every way of a set set */
+#define SET_FULL ((1u << SET_WAYS) - 1)
+
+struct cache {
+  unsigned int* tags;               /* tag bits of each line */
+  word_t* data;                     /* LINE_WORDS words of each line */
+  unsigned int* valid;              /* valid bit of each way, one mask per set */
+  unsigned int* dirty;              /* dirty bit of each way, one mask per set */
+  unsigned int* fifo;               /* ring-buffer head (oldest way) of each set */
+  unsigned int isEnabled;           /* if the cache is enabled */
+  unsigned int accessCounter;       /* times of cache access */
+  unsigned int hitCounter;          /* times of cache hit */
+  unsigned int missCounter;         /* times of cache miss */
+  unsigned int replaceCounter;      /* times of cache line replacement */
+  unsigned int wbCounter;           /* times of write back */
+};
+
+typedef void (*cache_func)(struct cache*, unsigned int, unsigned int, word_t*);
+
+struct cache cache;
+
+static unsigned int add_cache_line(struct cache*, unsigned int);
+static void cache_fill_line(struct cache*, unsigned int, unsigned int, md_addr_t);
+
+/* empty the cache and reset the counters */
+static void cache_init() {
+  free(cache.tags);
+  free(cache.data);
+  free(cache.valid);
+  free(cache.dirty);
+  free(cache.fifo);
+  cache.tags = calloc(SET_NUM * SET_WAYS, sizeof(unsigned int));
+  cache.data = calloc(SET_NUM * SET_WAYS * LINE_WORDS, sizeof(word_t));
+  cache.valid = calloc(SET_NUM, sizeof(unsigned int));
+  cache.dirty = calloc(SET_NUM, sizeof(unsigned int));
+  cache.fifo = calloc(SET_NUM, sizeof(unsigned int));
+  if (!cache.tags || !cache.data || !cache.valid || !cache.dirty || !cache.fifo)
+    fatal("out of virtual memory");
+  cache.isEnabled = 1;
+  cache.accessCounter = 0;
+  cache.hitCounter = 0;
+  cache.missCounter = 0;
+  cache.replaceCounter = 0;
+  cache.wbCounter = 0;
+}
+
+static void cache_do_read(struct cache* cp, unsigned int line, unsigned int offset, word_t* dst) {
+  memcpy(dst, (char *)(cp->data + line * LINE_WORDS) + offset, sizeof(word_t));
+}
+
+static void cache_do_write(struct cache* cp, unsigned int line, unsigned int offset, word_t* src) {
+  memcpy((char *)(cp->data + line * LINE_WORDS) + offset, src, sizeof(word_t));
+  cp->dirty[line / SET_WAYS] |= 1 << (line % SET_WAYS);
+}
+
+static unsigned int cache_access(struct cache* cp, md_addr_t addr, word_t* wp, cache_func func) {
+  unsigned int tag = ADDR_TAG(addr);
+  unsigned int idx = ADDR_IDX(addr);
+  unsigned int offset = ADDR_OFFSET(addr);
+
+  unsigned int* tags = cp->tags + LINE_IDX(idx, 0);
+  unsigned int valid = cp->valid[idx];
+  md_addr_t align_addr = addr & (~0xF);
+  unsigned int way;
+
+  ++cp->accessCounter;
+
+  for (way = 0; way < SET_WAYS; ++way) {
+    if ((valid & (1 << way)) && tag == tags[way]) {
+      ++cp->hitCounter;
+      func(cp, LINE_IDX(idx, way), offset, wp);
+      return HIT_LATENCY;
+    }
+  }
+
+  ++cp->missCounter;
+  way = add_cache_line(cp, idx);
+  cache_fill_line(cp, idx, way, align_addr);
+  func(cp, LINE_IDX(idx, way), offset, wp);
+  return MISS_LATENCY;
+}
+
+static unsigned int cache_read(struct cache* cp, md_addr_t addr, word_t* wp) {
+  return cache_access(cp, addr, wp, cache_do_read);
+}
+
+static unsigned int cache_write(struct cache* cp, md_addr_t addr, word_t* wp) {
+  return cache_access(cp, addr, wp, cache_do_write);
+}
+
+static void cache_fill_line(struct cache* cp, unsigned int idx, unsigned int way, md_addr_t addr) {
+  unsigned int line = LINE_IDX(idx, way);
+  word_t* lp = cp->data + line * LINE_WORDS;
+  int i;
+  for (i = 0; i < LINE_WORDS; ++i) {
+    lp[i] = READ_WORD(addr + (i * 4));
+  }
+  cp->tags[line] = ADDR_TAG(addr);
+  cp->valid[idx] |= 1 << way;
+  cp->dirty[idx] &= ~(1 << way);
+}
+
+static void cache_write_back(struct cache* cp, unsigned int idx, unsigned int way) {
+  unsigned int line = LINE_IDX(idx, way);
+  word_t* lp = cp->data + line * LINE_WORDS;
+  md_addr_t addr = (cp->tags[line] << 8) | (idx << 4);
+  int i;
+  for (i = 0; i < LINE_WORDS; ++i) {
+    WRITE_WORD(lp[i], addr + (i * 4));
+  }
+  cp->dirty[idx] &= ~(1 << way);
+}
+
+static unsigned int add_cache_line(struct cache* cp, unsigned int idx) {
+  unsigned int way;
+  if (cp->valid[idx] != SET_FULL) {
+    /* lines are never invalidated, so the set fills up in way order */
+    for (way = 0; cp->valid[idx] & (1 << way); ++way)
+      ;
+    return way;
+  }
+  /* FIFO: replace the oldest way and advance the ring-buffer head */
+  way = cp->fifo[idx];
+  cp->fifo[idx] = (way + 1) % SET_WAYS;
+  if (cp->dirty[idx] & (1 << way)) {
+    ++cp->wbCounter;
+    cache_write_back(cp, idx, way);
+  }
+  ++cp->replaceCounter;
+  return way;
+}
+
+#endif /* LINKED_LIST_SETS */
+
+#define RUNS 5
+
+static double now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* the matmul of test_program_layout.c, 300 times, with the fetches of its
+   inner loop: 36 accesses an iteration, 97% hits */
+static unsigned long stream_matmul(void) {
+  md_addr_t A = 0x10000800, B = 0x10000000, C = 0x10000400, PC = 0x400150;
+  unsigned long n = 0;
+  word_t w = 0;
+  int r, i, j, k, p;
+  for (r = 0; r < 300; ++r)
+    for (i = 0; i < 16; ++i)
+      for (j = 0; j < 16; ++j)
+        for (k = 0; k < 16; ++k) {
+          for (p = 0; p < 16; ++p) {
+            cache_read(&cache, PC + p * 8, &w);
+            cache_read(&cache, PC + p * 8 + 4, &w);
+          }
+          cache_read(&cache, A + (i * 16 + k) * 4, &w);
+          cache_read(&cache, B + (k * 16 + j) * 4, &w);
+          cache_read(&cache, C + (i * 16 + j) * 4, &w);
+          cache_write(&cache, C + (i * 16 + j) * 4, &w);
+          n += 36;
+        }
+  return n;
+}
+
+/* 20 M random words over 256 KB, one in 4 a store: over 99% misses */
+static unsigned long stream_random(void) {
+  unsigned int rng = 12345;
+  md_addr_t a;
+  word_t w = 0;
+  int r;
+  for (r = 0; r < 20000000; ++r) {
+    rng = rng * 1103515245 + 12345;
+    a = 0x10000000 + ((rng >> 8) & 0x3fffc);
+    if (rng & 0x3)
+      cache_read(&cache, a, &w);
+    else
+      cache_write(&cache, a, &w);
+  }
+  return 20000000;
+}
+
+static void bench(const char* name, unsigned long (*stream)(void)) {
+  double t, best = 1e9;
+  unsigned long n = 0;
+  int i;
+  for (i = 0; i < RUNS; ++i) {
+    cache_init();
+    t = now();
+    n = stream();
+    t = now() - t;
+    if (t < best)
+      best = t;
+  }
+  printf("%-7s %10lu accesses %7.1f M lookups/s  hits %u misses %u "
+         "replacements %u write backs %u\n", name, n, n / best / 1e6,
+         cache.hitCounter, cache.missCounter, cache.replaceCounter,
+         cache.wbCounter);
+}
+
+int main(void) {
+  printf("%s, best of %d runs\n", ENGINE, RUNS);
+  bench("matmul", stream_matmul);
+  bench("random", stream_random);
+  return 0;
+}
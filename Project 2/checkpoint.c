@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Writer and reader of the architected state checkpoints, see checkpoint.h
+   for the file format.  Restoring maps the saved pages copy-on-write, so
+   many runs started from one checkpoint share them until they write. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "regs.h"
+#include "memory.h"
+#include "loader.h"
+#include "checkpoint.h"
+
+/* a saved page and its address */
+struct ckpt_page {
+  md_addr_t addr;
+  byte_t* page;
+};
+
+static int page_cmp(const void* a, const void* b) {
+  md_addr_t x = ((struct ckpt_page*)a)->addr, y = ((struct ckpt_page*)b)->addr;
+  return x < y ? -1 : x > y;
+}
+
+/* file offset of the first page after a header and n page addresses */
+static long pages_offset(word_t n) {
+  long off = sizeof(struct ckpt_header) + n * sizeof(md_addr_t);
+  return (off + MD_PAGE_SIZE - 1) & ~(long)(MD_PAGE_SIZE - 1);
+}
+
+void ckpt_write(FILE* fp, void* p, size_t n) {
+  if (n && fwrite(p, n, 1, fp) != 1)
+    fatal("cannot write the checkpoint");
+}
+
+void ckpt_read(FILE* fp, void* p, size_t n) {
+  if (n && fread(p, n, 1, fp) != 1)
+    fatal("checkpoint is truncated");
+}
+
+FILE* ckpt_save(char* fname, char* sim, counter_t insn, struct regs_t* regs,
+                struct mem_t* mem) {
+  static byte_t zero[MD_PAGE_SIZE];
+  struct ckpt_header hdr;
+  struct ckpt_page* pages;
+  struct mem_pte_t* pte;
+  unsigned int i, n = 0;
+  FILE* fp;
+
+  /* the allocated pages are the ones the program touched, all-zero ones
+     need not be kept */
+  for (i = 0; i < MEM_PTAB_SIZE; ++i) {
+    for (pte = mem->ptab[i]; pte; pte = pte->next)
+      ++n;
+  }
+  pages = (struct ckpt_page*)malloc((n + 1) * sizeof(struct ckpt_page));
+  if (!pages)
+    fatal("out of virtual memory");
+  n = 0;
+  for (i = 0; i < MEM_PTAB_SIZE; ++i) {
+    for (pte = mem->ptab[i]; pte; pte = pte->next) {
+      if (!memcmp(pte->page, zero, MD_PAGE_SIZE))
+        continue;
+      pages[n].addr = MEM_PTE_ADDR(pte, i);
+      pages[n++].page = pte->page;
+    }
+  }
+  qsort(pages, n, sizeof(struct ckpt_page), page_cmp);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CKPT_MAGIC, CKPT_MAGIC_LEN);
+  if (sim)
+    strncpy(hdr.sim, sim, CKPT_SIM_LEN - 1);
+  hdr.insn = insn;
+  hdr.page_size = MD_PAGE_SIZE;
+  hdr.npages = n;
+  hdr.text_base = ld_text_base;
+  hdr.text_size = ld_text_size;
+  hdr.data_base = ld_data_base;
+  hdr.data_size = ld_data_size;
+  hdr.brk_point = ld_brk_point;
+  hdr.stack_base = ld_stack_base;
+  hdr.stack_size = ld_stack_size;
+  hdr.stack_min = ld_stack_min;
+  hdr.prog_entry = ld_prog_entry;
+  hdr.environ_base = ld_environ_base;
+  hdr.target_big_endian = ld_target_big_endian;
+  hdr.regs = *regs;
+
+  fp = fopen(fname, "w+b");
+  if (!fp)
+    fatal("cannot open checkpoint `%s'", fname);
+  ckpt_write(fp, &hdr, sizeof(hdr));
+  for (i = 0; i < n; ++i)
+    ckpt_write(fp, &pages[i].addr, sizeof(md_addr_t));
+  if (fseek(fp, pages_offset(n), SEEK_SET))
+    fatal("cannot write the checkpoint");
+  for (i = 0; i < n; ++i)
+    ckpt_write(fp, pages[i].page, MD_PAGE_SIZE);
+  free(pages);
+  return fp;
+}
+
+FILE* ckpt_load(char* fname, struct ckpt_header* hdr, struct regs_t* regs,
+                struct mem_t* mem) {
+  md_addr_t* addrs;
+  struct mem_pte_t* pte;
+  byte_t* map = NULL;
+  long off;
+  word_t i;
+  FILE* fp;
+
+  fp = fopen(fname, "rb");
+  if (!fp)
+    fatal("cannot open checkpoint `%s'", fname);
+  ckpt_read(fp, hdr, sizeof(*hdr));
+  if (memcmp(hdr->magic, CKPT_MAGIC, CKPT_MAGIC_LEN))
+    fatal("`%s' is not a checkpoint", fname);
+  if (hdr->page_size != MD_PAGE_SIZE)
+    fatal("checkpoint `%s' has pages of %d bytes, not %d", fname,
+          hdr->page_size, MD_PAGE_SIZE);
+
+  addrs = (md_addr_t*)malloc((hdr->npages + 1) * sizeof(md_addr_t));
+  if (!addrs)
+    fatal("out of virtual memory");
+  for (i = 0; i < hdr->npages; ++i)
+    ckpt_read(fp, &addrs[i], sizeof(md_addr_t));
+
+  /* map the pages from the file if they sit on host page boundaries, read
+     them in otherwise */
+  off = pages_offset(hdr->npages);
+  if (hdr->npages) {
+    if (MD_PAGE_SIZE % sysconf(_SC_PAGESIZE) == 0) {
+      map = (byte_t*)mmap(NULL, (size_t)hdr->npages * MD_PAGE_SIZE,
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), off);
+      if (map == (byte_t*)MAP_FAILED)
+        fatal("cannot map the pages of checkpoint `%s'", fname);
+    } else {
+      map = (byte_t*)malloc((size_t)hdr->npages * MD_PAGE_SIZE);
+      if (!map)
+        fatal("out of virtual memory");
+      if (fseek(fp, off, SEEK_SET))
+        fatal("checkpoint is truncated");
+      ckpt_read(fp, map, (size_t)hdr->npages * MD_PAGE_SIZE);
+    }
+  }
+  for (i = 0; i < hdr->npages; ++i) {
+    pte = (struct mem_pte_t*)calloc(1, sizeof(struct mem_pte_t));
+    if (!pte)
+      fatal("out of virtual memory");
+    pte->tag = MEM_PTAB_TAG(addrs[i]);
+    pte->page = map + (size_t)i * MD_PAGE_SIZE;
+    pte->next = mem->ptab[MEM_PTAB_SET(addrs[i])];
+    mem->ptab[MEM_PTAB_SET(addrs[i])] = pte;
+    mem->page_count++;
+  }
+  free(addrs);
+
+  ld_text_base = hdr->text_base;
+  ld_text_size = hdr->text_size;
+  ld_data_base = hdr->data_base;
+  ld_data_size = hdr->data_size;
+  ld_brk_point = hdr->brk_point;
+  ld_stack_base = hdr->stack_base;
+  ld_stack_size = hdr->stack_size;
+  ld_stack_min = hdr->stack_min;
+  ld_prog_entry = hdr->prog_entry;
+  ld_environ_base = hdr->environ_base;
+  ld_target_big_endian = hdr->target_big_endian;
+  *regs = hdr->regs;
+
+  if (fseek(fp, off + (long)hdr->npages * MD_PAGE_SIZE, SEEK_SET))
+    fatal("checkpoint is truncated");
+  return fp;
+}
@@ -0,0 +1,64 @@
+/* architected state checkpoints of sim-fast and sim-pipe */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+#include "regs.h"
+#include "memory.h"
+
+/*
+ * A checkpoint file starts with struct ckpt_header: the CKPT_MAGIC bytes,
+ * the name of the simulator whose own state follows the memory ("" for
+ * none), the instructions run when it was taken, the layout the loader
+ * gave the program, and the registers. The addresses of the saved pages
+ * follow in increasing order, then the pages themselves from the first
+ * file offset that is a multiple of MD_PAGE_SIZE, so a restore maps them
+ * straight from the file. Pages holding only zeroes are left out, as an
+ * unallocated page reads as zeroes. The state of the simulator named in
+ * the header comes last. The file is in the byte order and structure
+ * layout of the host that wrote it.
+ */
+#define CKPT_MAGIC "SSCKPT1"
+#define CKPT_MAGIC_LEN 8
+#define CKPT_SIM_LEN 16
+
+struct ckpt_header {
+  char magic[CKPT_MAGIC_LEN];
+  char sim[CKPT_SIM_LEN];            /* simulator whose state follows */
+  counter_t insn;                    /* instructions run when taken */
+  word_t page_size;                  /* MD_PAGE_SIZE of the writer */
+  word_t npages;                     /* pages saved */
+  md_addr_t text_base;               /* program layout, see loader.h */
+  unsigned int text_size;
+  md_addr_t data_base;
+  unsigned int data_size;
+  md_addr_t brk_point;
+  md_addr_t stack_base;
+  unsigned int stack_size;
+  md_addr_t stack_min;
+  md_addr_t prog_entry;
+  md_addr_t environ_base;
+  int target_big_endian;
+  struct regs_t regs;                /* registers */
+};
+
+/* write the registers, the pages of memory and the program layout to a
+   checkpoint, taken after insn instructions; the file is returned open
+   after the pages, for the state of the simulator sim (NULL for none) */
+FILE* ckpt_save(char* fname, char* sim, counter_t insn, struct regs_t* regs,
+                struct mem_t* mem);
+
+/* read a checkpoint back into the registers, an empty memory and the
+   program layout, the pages are mapped copy-on-write from the file; the
+   header is left in hdr and the file returned open after the pages */
+FILE* ckpt_load(char* fname, struct ckpt_header* hdr, struct regs_t* regs,
+                struct mem_t* mem);
+
+/* write/read simulator state, a short file is fatal */
+void ckpt_write(FILE* fp, void* p, size_t n);
+void ckpt_read(FILE* fp, void* p, size_t n);
+
+#endif /* CHECKPOINT_H */
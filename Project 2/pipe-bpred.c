@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The branch predictor of sim-pipe: a direction predictor of the
+   conditional branches, a branch target buffer and a return address stack,
+   looked up by the fetch stage and trained when ID resolves the branch. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "options.h"
+#include "pipe-bpred.h"
+
+/* link register of jal, a jr through it is taken for a return */
+#define RA_REG 31
+
+/* predictor options */
+static char *bpred_name;
+static int bpred_size;
+static int bpred_hist;
+static int tage_size;
+static int btb_size;
+static int btb_assoc;
+static int ras_size;
+
+struct bpred bpred;
+
+/* register the options of the branch predictor */
+void
+bpred_reg_options(struct opt_odb_t *odb)
+{
+  opt_reg_string(odb, "-bpred",
+		 "branch predictor {nottaken|perfect|bimod|gshare|tage}",
+		 &bpred_name, /* default */"gshare",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:size",
+	      "entries of the bimod or gshare table, and of the base table "
+	      "of tage",
+	      &bpred_size, /* default */BPRED_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:hist", "global history bits of gshare",
+	      &bpred_hist, /* default */BPRED_HIST,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:tage:size", "entries of each tagged table of tage",
+	      &tage_size, /* default */TAGE_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:btb", "branch target buffer entries",
+	      &btb_size, /* default */BTB_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:btb:assoc",
+	      "branch target buffer associativity (in ways)",
+	      &btb_assoc, /* default */BTB_ASSOC,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-bpred:ras",
+	      "return address stack entries, 0 for none",
+	      &ras_size, /* default */RAS_SIZE,
+	      /* print */TRUE, /* format */NULL);
+}
+
+/* check the options of the branch predictor */
+void
+bpred_check_options()
+{
+  if (strcmp(bpred_name, "nottaken") && strcmp(bpred_name, "perfect")
+      && !bpred_lookup_policy(bpred_name))
+    fatal("unknown branch predictor `%s'", bpred_name);
+  if (bpred_size < 1 || (bpred_size & (bpred_size - 1)))
+    fatal("branch predictor table size must be a power of two");
+  if (bpred_hist < 0 || bpred_hist > 30)
+    fatal("gshare history must be between 0 and 30 bits");
+  if (tage_size < 1 || (tage_size & (tage_size - 1)))
+    fatal("tage table size must be a power of two");
+  if (btb_assoc < 1 || (btb_assoc & (btb_assoc - 1)))
+    fatal("BTB associativity must be a power of two");
+  if (btb_size < btb_assoc || (btb_size & (btb_size - 1)))
+    fatal("BTB size must be a power of two, at least its associativity");
+  if (ras_size < 0)
+    fatal("return address stack size must not be negative");
+}
+
+/* 2-bit saturating counters, taken from 2 up */
+static void ctr_update(unsigned char* ctr, int taken) {
+  if (taken && *ctr < 3)
+    ++*ctr;
+  else if (!taken && *ctr > 0)
+    --*ctr;
+}
+
+/* bimod: a table of 2-bit counters indexed by the pc */
+
+static unsigned int bimod_size(struct bpred* bp) {
+  return bp->size;
+}
+
+static void bimod_init(struct bpred* bp) {
+  /* weakly not taken */
+  memset(bp->state, 1, bp->size);
+}
+
+static unsigned char* bimod_ctr(struct bpred* bp, md_addr_t pc) {
+  return (unsigned char*)bp->state + ((pc >> 3) & (bp->size - 1));
+}
+
+static int bimod_lookup(struct bpred* bp, md_addr_t pc) {
+  return *bimod_ctr(bp, pc) >= 2;
+}
+
+static void bimod_update(struct bpred* bp, md_addr_t pc, int taken) {
+  ctr_update(bimod_ctr(bp, pc), taken);
+}
+
+/* gshare (McFarling): the counters are indexed by the pc xor the global
+   history, so a branch gets a counter for each path leading to it */
+
+static unsigned char* gshare_ctr(struct bpred* bp, md_addr_t pc) {
+  word_t hist = bp->hist & ((1u << bp->hist_bits) - 1);
+  return (unsigned char*)bp->state + (((pc >> 3) ^ hist) & (bp->size - 1));
+}
+
+static int gshare_lookup(struct bpred* bp, md_addr_t pc) {
+  return *gshare_ctr(bp, pc) >= 2;
+}
+
+static void gshare_update(struct bpred* bp, md_addr_t pc, int taken) {
+  ctr_update(gshare_ctr(bp, pc), taken);
+}
+
+/* tage (Seznec): a bimodal base table and TAGE_TABLES tagged tables
+   indexed by the pc hashed with ever longer global histories; the longest
+   one whose tag matches provides the prediction. A misprediction
+   allocates an entry in a longer table, taking one whose useful counter
+   is 0. This one keeps no alternate prediction for fresh entries and at
+   most 32 history bits. */
+
+static const unsigned int tage_hist[TAGE_TABLES] = { 4, 8, 16, 32 };
+
+/* the tagged tables, one after the other, then the base table */
+#define TAGE_ENTRY(BP, T, IDX)						\
+  ((struct tage_entry*)(BP)->state + (T) * (BP)->tage_size + (IDX))
+#define TAGE_BASE(BP)							\
+  ((unsigned char*)TAGE_ENTRY(BP, TAGE_TABLES, 0))
+
+/* xor the last len outcomes of the history into bits bits */
+static unsigned int hist_fold(word_t hist, unsigned int len, unsigned int bits) {
+  unsigned int f = 0;
+  if (len < 32)
+    hist &= (1u << len) - 1;
+  for (; hist; hist >>= bits)
+    f ^= hist & ((1u << bits) - 1);
+  return f;
+}
+
+static unsigned int tage_idx(struct bpred* bp, md_addr_t pc, int t) {
+  return ((pc >> 3) ^ (pc >> (3 + bp->tage_shift))
+          ^ hist_fold(bp->hist, tage_hist[t], bp->tage_shift))
+         & (bp->tage_size - 1);
+}
+
+static unsigned short tage_tag(struct bpred* bp, md_addr_t pc, int t) {
+  unsigned int tag = (pc >> 3) ^ hist_fold(bp->hist, tage_hist[t], TAGE_TAG_BITS)
+                     ^ (hist_fold(bp->hist, tage_hist[t], TAGE_TAG_BITS - 1) << 1);
+  return (tag & ((1 << TAGE_TAG_BITS) - 1)) | (1 << TAGE_TAG_BITS);
+}
+
+/* the longest tagged table matching pc below table below, -1 for none */
+static int tage_match(struct bpred* bp, md_addr_t pc, int below) {
+  int t;
+  for (t = below - 1; t >= 0; --t) {
+    if (TAGE_ENTRY(bp, t, tage_idx(bp, pc, t))->tag == tage_tag(bp, pc, t))
+      return t;
+  }
+  return -1;
+}
+
+/* prediction of table t, the base table for -1 */
+static int tage_pred(struct bpred* bp, md_addr_t pc, int t) {
+  if (t < 0)
+    return TAGE_BASE(bp)[(pc >> 3) & (bp->size - 1)] >= 2;
+  return TAGE_ENTRY(bp, t, tage_idx(bp, pc, t))->ctr >= 0;
+}
+
+static unsigned int tage_size_of(struct bpred* bp) {
+  return TAGE_TABLES * bp->tage_size * sizeof(struct tage_entry) + bp->size;
+}
+
+static void tage_init(struct bpred* bp) {
+  memset(bp->state, 0, TAGE_TABLES * bp->tage_size * sizeof(struct tage_entry));
+  memset(TAGE_BASE(bp), 1, bp->size);
+}
+
+static int tage_lookup(struct bpred* bp, md_addr_t pc) {
+  return tage_pred(bp, pc, tage_match(bp, pc, TAGE_TABLES));
+}
+
+static void tage_update(struct bpred* bp, md_addr_t pc, int taken) {
+  int prov = tage_match(bp, pc, TAGE_TABLES), pred, alt, t;
+  struct tage_entry* e;
+  unsigned int i;
+
+  pred = tage_pred(bp, pc, prov);
+  if (prov < 0) {
+    ctr_update(&TAGE_BASE(bp)[(pc >> 3) & (bp->size - 1)], taken);
+  } else {
+    e = TAGE_ENTRY(bp, prov, tage_idx(bp, pc, prov));
+    if (taken && e->ctr < 3)
+      ++e->ctr;
+    else if (!taken && e->ctr > -4)
+      --e->ctr;
+    /* the provider is useful if it beat the next shorter match */
+    alt = tage_pred(bp, pc, tage_match(bp, pc, prov));
+    if (pred != alt) {
+      if (pred == taken && e->u < 3)
+        ++e->u;
+      else if (pred != taken && e->u > 0)
+        --e->u;
+    }
+  }
+
+  /* allocate in the first longer table with a useless entry, or make
+     the entries of all longer tables age */
+  if (pred != taken) {
+    for (t = prov + 1; t < TAGE_TABLES; ++t) {
+      e = TAGE_ENTRY(bp, t, tage_idx(bp, pc, t));
+      if (!e->u) {
+        e->tag = tage_tag(bp, pc, t);
+        e->ctr = taken ? 0 : -1;
+        break;
+      }
+    }
+    if (t == TAGE_TABLES) {
+      for (t = prov + 1; t < TAGE_TABLES; ++t) {
+        e = TAGE_ENTRY(bp, t, tage_idx(bp, pc, t));
+        if (e->u)
+          --e->u;
+      }
+    }
+  }
+
+  /* entries that were once useful are not kept forever */
+  if (++bp->tage_ticks == TAGE_AGING) {
+    bp->tage_ticks = 0;
+    for (i = 0; i < TAGE_TABLES * bp->tage_size; ++i)
+      TAGE_ENTRY(bp, 0, i)->u >>= 1;
+  }
+}
+
+static struct dir_policy dir_policies[] = {
+  { "bimod", bimod_size, bimod_init, bimod_lookup, bimod_update },
+  { "gshare", bimod_size, bimod_init, gshare_lookup, gshare_update },
+  { "tage", tage_size_of, tage_init, tage_lookup, tage_update },
+};
+
+struct dir_policy* bpred_lookup_policy(char* name) {
+  unsigned int i;
+  for (i = 0; i < sizeof(dir_policies) / sizeof(dir_policies[0]); ++i) {
+    if (!strcmp(dir_policies[i].name, name))
+      return &dir_policies[i];
+  }
+  return NULL;
+}
+
+/* build the branch predictor */
+void
+bpred_init()
+{
+  struct bpred* bp = &bpred;
+
+  memset(bp, 0, sizeof(*bp));
+  bp->perfect = !strcmp(bpred_name, "perfect");
+  bp->policy = bpred_lookup_policy(bpred_name);
+  if (!bp->policy)
+    return;
+
+  bp->size = bpred_size;
+  bp->hist_bits = bpred_hist;
+  bp->tage_size = tage_size;
+  bp->tage_shift = log_base2(tage_size);
+  bp->state_size = bp->policy->size(bp);
+  bp->state = malloc(bp->state_size);
+  bp->btb_sets = btb_size / btb_assoc;
+  bp->btb_assoc = btb_assoc;
+  bp->btb = (struct btb_entry*)calloc(btb_size, sizeof(struct btb_entry));
+  bp->ras_size = ras_size;
+  bp->ras = (md_addr_t*)calloc(ras_size + 1, sizeof(md_addr_t));
+  if (!bp->state || !bp->btb || !bp->ras)
+    fatal("out of virtual memory");
+  bp->policy->init(bp);
+}
+
+/* the BTB entry of pc, NULL on miss */
+static struct btb_entry* btb_probe(struct bpred* bp, md_addr_t pc) {
+  struct btb_entry* set = bp->btb + ((pc >> 3) & (bp->btb_sets - 1)) * bp->btb_assoc;
+  unsigned int w;
+  for (w = 0; w < bp->btb_assoc; ++w) {
+    if (set[w].pc == pc)
+      return &set[w];
+  }
+  return NULL;
+}
+
+/* remember where pc went when taken, replacing the LRU entry of its set */
+static void btb_update(struct bpred* bp, md_addr_t pc, md_addr_t target) {
+  struct btb_entry* set = bp->btb + ((pc >> 3) & (bp->btb_sets - 1)) * bp->btb_assoc;
+  struct btb_entry* e = btb_probe(bp, pc);
+  unsigned int w;
+
+  if (!e) {
+    e = &set[0];
+    for (w = 1; w < bp->btb_assoc; ++w) {
+      if (set[w].stamp < e->stamp)
+        e = &set[w];
+    }
+    e->pc = pc;
+  }
+  e->target = target;
+  e->stamp = ++bp->btb_stamp;
+}
+
+static int is_return(enum md_opcode op, md_inst_t inst) {
+  return op == JR && ((inst.b >> 24) & 0xff) == RA_REG;
+}
+
+md_addr_t bpred_lookup(md_addr_t pc, md_inst_t inst, int update) {
+  struct bpred* bp = &bpred;
+  struct btb_entry* e;
+  enum md_opcode op;
+  unsigned int flags;
+  md_addr_t target;
+
+  MD_SET_OPCODE(op, inst);
+  flags = MD_OP_FLAGS(op);
+  if (!bp->policy || !(flags & F_CTRL))
+    return pc + sizeof(md_inst_t);
+
+  if (bp->ras_size && is_return(op, inst)) {
+    target = bp->ras[bp->ras_top];
+    if (update)
+      bp->ras_top = (bp->ras_top + bp->ras_size - 1) % bp->ras_size;
+    return target;
+  }
+  if (bp->ras_size && (flags & F_CALL) && update) {
+    bp->ras_top = (bp->ras_top + 1) % bp->ras_size;
+    bp->ras[bp->ras_top] = pc + sizeof(md_inst_t);
+  }
+
+  /* a taken prediction needs the target from the BTB */
+  e = btb_probe(bp, pc);
+  if (!e || ((flags & F_COND) && !bp->policy->lookup(bp, pc)))
+    return pc + sizeof(md_inst_t);
+  e->stamp = ++bp->btb_stamp;
+  return e->target;
+}
+
+int bpred_update(md_addr_t pc, md_inst_t inst, md_addr_t npc, md_addr_t pred) {
+  struct bpred* bp = &bpred;
+  struct btb_entry* e;
+  enum md_opcode op;
+  unsigned int flags;
+  int taken = npc != pc + sizeof(md_inst_t);
+
+  MD_SET_OPCODE(op, inst);
+  flags = MD_OP_FLAGS(op);
+  if (!(flags & F_CTRL))
+    return npc != pred;
+
+  ++bp->ctrlCounter;
+  if (flags & F_COND) {
+    ++bp->condCounter;
+    if (bp->policy) {
+      if (bp->policy->lookup(bp, pc) == taken)
+        ++bp->dirHitCounter;
+      bp->policy->update(bp, pc, taken);
+    } else if (!taken || bp->perfect) {
+      ++bp->dirHitCounter;
+    }
+    bp->hist = (bp->hist << 1) | taken;
+  }
+  if (is_return(op, inst)) {
+    ++bp->retCounter;
+    if (bp->ras_size && npc == pred)
+      ++bp->rasHitCounter;
+  }
+  if (bp->policy && taken) {
+    e = btb_probe(bp, pc);
+    if (!e || e->target != npc)
+      ++bp->btbMissCounter;
+    btb_update(bp, pc, npc);
+  }
+
+  if (npc == pred)
+    return FALSE;
+  if (!bp->perfect)
+    ++bp->missCounter;
+  return TRUE;
+}
+
+void bpred_train(md_addr_t pc, md_inst_t inst, md_addr_t npc) {
+  bpred_update(pc, inst, npc, bpred_lookup(pc, inst, TRUE));
+}
+
+void bpred_log() {
+  struct bpred* bp = &bpred;
+  printf("[bpred] Total number of control instructions: %d\n", bp->ctrlCounter);
+  printf("[bpred] Total number of conditional branches: %d\n", bp->condCounter);
+  printf("[bpred] Total number of directions predicted: %d\n", bp->dirHitCounter);
+  if (bp->policy)
+    printf("[bpred] Total number of BTB misses: %d\n", bp->btbMissCounter);
+  if (bp->ras_size) {
+    printf("[bpred] Total number of returns: %d\n", bp->retCounter);
+    printf("[bpred] Total number of returns predicted by the RAS: %d\n", bp->rasHitCounter);
+  }
+  printf("[bpred] Total number of mispredictions: %d\n", bp->missCounter);
+  if (bp->ctrlCounter)
+    printf("[bpred] Prediction accuracy: %.2f%%\n",
+           100.0 * (bp->ctrlCounter - bp->missCounter) / bp->ctrlCounter);
+}
+
+void bpred_end_warmup() {
+  /* the counters are the last fields of struct bpred */
+  memset(&bpred.ctrlCounter, 0,
+         (char*)(&bpred.missCounter + 1) - (char*)&bpred.ctrlCounter);
+}
+
+/* write or read back one block of predictor state, a short file is fatal */
+static void bpred_io(FILE* fp, void* p, size_t n, int save) {
+  if (!n)
+    return;
+  if (save ? fwrite(p, n, 1, fp) != 1 : fread(p, n, 1, fp) != 1)
+    fatal(save ? "cannot write the predictor state" : "predictor state is truncated");
+}
+
+/* write or read back the tables, the history and the counters; a restore
+   checks that the predictor is built the same way first */
+static void bpred_state(FILE* fp, int save) {
+  struct bpred* bp = &bpred;
+  unsigned int geom[7], saved[7];
+
+  geom[0] = bp->policy ? (unsigned int)(bp->policy - dir_policies) + 1 : 0;
+  geom[1] = bp->perfect;
+  geom[2] = bp->state_size;
+  geom[3] = bp->hist_bits;
+  geom[4] = bp->btb_sets;
+  geom[5] = bp->btb_assoc;
+  geom[6] = bp->ras_size;
+  memcpy(saved, geom, sizeof(geom));
+  bpred_io(fp, saved, sizeof(saved), save);
+  if (memcmp(saved, geom, sizeof(geom)))
+    fatal("the saved branch predictor is not configured like this one");
+
+  if (bp->policy) {
+    bpred_io(fp, bp->state, bp->state_size, save);
+    bpred_io(fp, bp->btb, bp->btb_sets * bp->btb_assoc * sizeof(struct btb_entry), save);
+    bpred_io(fp, bp->ras, bp->ras_size * sizeof(md_addr_t), save);
+  }
+  bpred_io(fp, &bp->hist, sizeof(bp->hist), save);
+  bpred_io(fp, &bp->tage_ticks, sizeof(bp->tage_ticks), save);
+  bpred_io(fp, &bp->btb_stamp, sizeof(bp->btb_stamp), save);
+  bpred_io(fp, &bp->ras_top, sizeof(bp->ras_top), save);
+  bpred_io(fp, &bp->ctrlCounter,
+           (char*)(&bp->missCounter + 1) - (char*)&bp->ctrlCounter, save);
+}
+
+void bpred_save(FILE* fp) {
+  bpred_state(fp, TRUE);
+}
+
+void bpred_restore(FILE* fp) {
+  bpred_state(fp, FALSE);
+}
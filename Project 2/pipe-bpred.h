@@ -0,0 +1,119 @@
+/* Branch predictor of the sim-pipe fetch stage */
+
+#ifndef PIPE_BPRED_H
+#define PIPE_BPRED_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+#include "options.h"
+
+#define BPRED_SIZE 2048     /* default entries of a direction table */
+#define BPRED_HIST 11     /* default global history bits of gshare */
+#define TAGE_TABLES 4     /* tagged tables of TAGE, with 4, 8, 16 and 32 history bits */
+#define TAGE_SIZE 256     /* default entries of each tagged table */
+#define TAGE_TAG_BITS 8     /* tag bits of a tagged entry */
+#define TAGE_AGING 262144     /* branches between two halvings of the useful counters */
+#define BTB_SIZE 512     /* default branch target buffer entries */
+#define BTB_ASSOC 4     /* default BTB is 4-way set-associative */
+#define RAS_SIZE 8     /* default return address stack entries */
+
+struct bpred;
+
+/* direction predictor of the conditional branches, its tables live in
+   size bytes of private state at bp->state; lookup is called when a
+   branch is fetched and update when ID resolves it, and no other branch
+   is resolved in between, so update finds the entries of the lookup again
+   from the pc and the global history */
+struct dir_policy {
+  char* name;                                           /* option name */
+  unsigned int (*size)(struct bpred*);                  /* bytes of state */
+  void (*init)(struct bpred*);                          /* reset the state */
+  int (*lookup)(struct bpred*, md_addr_t);              /* TRUE if predicted taken */
+  void (*update)(struct bpred*, md_addr_t, int);        /* resolved taken or not */
+};
+
+/* tagged entry of TAGE */
+struct tage_entry {
+  unsigned short tag;               /* partial tag, with bit TAGE_TAG_BITS set once valid */
+  signed char ctr;                  /* 3-bit signed counter, taken if not negative */
+  unsigned char u;                  /* 2-bit useful counter */
+};
+
+/* branch target buffer entry */
+struct btb_entry {
+  md_addr_t pc;                     /* pc of the control instruction, 0 if empty */
+  md_addr_t target;                 /* where it last went when taken */
+  unsigned int stamp;               /* lookup count of its last use, for LRU */
+};
+
+struct bpred {
+  struct dir_policy* policy;        /* direction predictor, NULL to predict PC + 8 */
+  unsigned int perfect;             /* if ID redirects the fetch of the same cycle */
+  unsigned int size;                /* entries of a direction table */
+  unsigned int hist_bits;           /* global history bits of gshare */
+  word_t hist;                      /* outcomes of the last conditional branches, newest in bit 0 */
+  unsigned int tage_size;           /* entries of each tagged table */
+  unsigned int tage_shift;          /* log2 of tage_size */
+  unsigned int tage_ticks;          /* branches since the useful counters aged */
+  void* state;                      /* private state of the direction predictor */
+  unsigned int state_size;          /* its bytes */
+  unsigned int btb_sets;            /* BTB sets, 0 for no BTB */
+  unsigned int btb_assoc;           /* BTB ways of each set */
+  unsigned int btb_stamp;           /* BTB lookups so far */
+  struct btb_entry* btb;            /* btb_sets * btb_assoc entries */
+  unsigned int ras_size;            /* return address stack entries, 0 for none */
+  unsigned int ras_top;             /* entry of the last pushed return address */
+  md_addr_t* ras;                   /* circular, the oldest entry is overwritten */
+  unsigned int ctrlCounter;         /* times of control instruction resolved */
+  unsigned int condCounter;         /* times of conditional branch resolved */
+  unsigned int dirHitCounter;       /* conditional branches whose direction was predicted */
+  unsigned int btbMissCounter;      /* taken control instructions the BTB had no right target for */
+  unsigned int retCounter;          /* times of jr $31 resolved */
+  unsigned int rasHitCounter;       /* returns predicted by the return address stack */
+  unsigned int missCounter;         /* times of fetch redirected by ID */
+};
+
+/* register the options of the branch predictor */
+void bpred_reg_options(struct opt_odb_t*);
+
+/* check the options of the branch predictor */
+void bpred_check_options();
+
+/* build the branch predictor */
+void bpred_init();
+
+/* find a direction predictor by its option name, NULL if unknown */
+struct dir_policy* bpred_lookup_policy(char*);
+
+/* PC to fetch after the instruction fetched at pc; update is FALSE for a
+   fetch a load hazard throws away, which leaves the return address stack
+   alone since it is fetched again */
+md_addr_t bpred_lookup(md_addr_t, md_inst_t, int);
+
+/* the instruction at pc was resolved in ID to go on at npc, while fetch
+   went on at pred: train the predictor, TRUE if fetch must be redirected */
+int bpred_update(md_addr_t, md_inst_t, md_addr_t, md_addr_t);
+
+/* look up and resolve a control instruction at once, for the fast
+   forward */
+void bpred_train(md_addr_t, md_inst_t, md_addr_t);
+
+/* print branch predictor statistics */
+void bpred_log();
+
+/* clear the counters, keeping the tables warm */
+void bpred_end_warmup();
+
+/* write the tables and the counters to an open checkpoint */
+void bpred_save(FILE*);
+
+/* read them back, the predictor must be configured as it was when the
+   checkpoint was taken */
+void bpred_restore(FILE*);
+
+/* the branch predictor of the fetch stage */
+extern struct bpred bpred;
+
+#endif /* PIPE_BPRED_H */
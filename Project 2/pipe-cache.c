@@ -0,0 +1,1464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The cache hierarchy of sim-pipe: split L1 instruction/data caches and a
+   unified L2 in front of the simulated memory, with their options.  Kept
+   apart from the pipeline so the trace replay tool can drive it too. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+#include "options.h"
+#include "pipe-cache.h"
+
+/* simulated memory behind the last level */
+static struct mem_t *mem = NULL;
+
+#define READ_WORD(SRC, FAULT)						\
+  ((FAULT) = md_fault_none, MEM_READ_WORD(mem, (SRC)))
+#define WRITE_WORD(SRC, DST, FAULT)					\
+  ((FAULT) = md_fault_none, MEM_WRITE_WORD(mem, (DST), (SRC)))
+
+/* L1 cache geometry, for each of the instruction and data caches */
+static int cache_size;
+static int cache_assoc;
+static int cache_line;
+
+/* L1 cache replacement policy */
+static char *cache_repl;
+
+/* L2 cache geometry, size 0 for no L2 */
+static int l2_size;
+static int l2_assoc;
+static int l2_line;
+
+/* L2 cache replacement policy */
+static char *l2_repl;
+
+/* L2 inclusion of the L1 caches */
+static char *l2_incl;
+
+/* L2 and memory latencies */
+static int l2_lat;
+static int mem_lat;
+
+/* L1 prefetchers and their parameters */
+static char *il1_pf;
+static char *dl1_pf;
+static int pf_degree;
+static int pf_rpt;
+static int pf_streams;
+static int pf_depth;
+
+/* L1 data cache MSHRs, 0 for a blocking cache */
+static int dl1_mshr;
+
+/* L1 data cache write policy */
+static char *dl1_write;
+static int dl1_walloc;
+
+/* write buffer entries below each cache */
+static int wbuf_size;
+
+/* L1 victim cache lines */
+static int il1_victim;
+static int dl1_victim;
+
+/* L1 stack distance profiles and the largest geometry they cover */
+static int il1_mrc;
+static int dl1_mrc;
+static int mrc_sets;
+static int mrc_ways;
+
+struct cache il1;
+struct cache dl1;
+struct cache l2;
+
+/* register the options of the cache hierarchy */
+void
+cache_reg_options(struct opt_odb_t *odb)
+{
+  opt_reg_int(odb, "-cache:size",
+	      "L1 cache size (in bytes), for each of the I and D caches",
+	      &cache_size, /* default */CACHE_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:assoc", "L1 cache associativity (in ways)",
+	      &cache_assoc, /* default */CACHE_ASSOC,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:line", "L1 cache line size (in bytes)",
+	      &cache_line, /* default */CACHE_LINE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-cache:repl",
+		 "L1 cache replacement policy "
+		 "{fifo|lru|plru|srrip|brrip|random}",
+		 &cache_repl, /* default */"fifo",
+		 /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:l2:size",
+	      "unified L2 cache size (in bytes), 0 for no L2",
+	      &l2_size, /* default */L2_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:l2:assoc", "L2 cache associativity (in ways)",
+	      &l2_assoc, /* default */L2_ASSOC,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:l2:line", "L2 cache line size (in bytes)",
+	      &l2_line, /* default */L2_LINE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-cache:l2:repl",
+		 "L2 cache replacement policy "
+		 "{fifo|lru|plru|srrip|brrip|random}",
+		 &l2_repl, /* default */"fifo",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-cache:l2:incl",
+		 "L2 inclusion of the L1 caches {nine|inclusive|exclusive}",
+		 &l2_incl, /* default */"nine",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:l2:lat", "cycles added by an L2 access",
+	      &l2_lat, /* default */L2_LATENCY,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:mem:lat", "cycles added by a memory access",
+	      &mem_lat, /* default */MEM_LATENCY,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-cache:il1:pf",
+		 "L1 instruction cache prefetcher {none|nextline|stride|stream}",
+		 &il1_pf, /* default */"none",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-cache:dl1:pf",
+		 "L1 data cache prefetcher {none|nextline|stride|stream}",
+		 &dl1_pf, /* default */"none",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:pf:degree",
+	      "lines fetched ahead per next-line or stride trigger",
+	      &pf_degree, /* default */PF_DEGREE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:pf:rpt",
+	      "entries of the stride prefetcher reference prediction table",
+	      &pf_rpt, /* default */PF_RPT,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:pf:streams", "number of stream buffers",
+	      &pf_streams, /* default */PF_STREAMS,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:pf:depth", "lines held by each stream buffer",
+	      &pf_depth, /* default */PF_DEPTH,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:dl1:mshr",
+	      "L1 data cache MSHRs (outstanding misses), 0 for a blocking cache",
+	      &dl1_mshr, /* default */DL1_MSHR,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-cache:dl1:write",
+		 "L1 data cache write policy {back|through}",
+		 &dl1_write, /* default */"back",
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-cache:dl1:walloc",
+	       "allocate a L1 data cache line on a store miss",
+	       &dl1_walloc, /* default */TRUE,
+	       /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:wbuf",
+	      "entries of the coalescing write buffer below the L1 data and "
+	      "L2 caches, 0 for synchronous writes",
+	      &wbuf_size, /* default */WBUF_SIZE,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-cache:il1:victim",
+	      "lines of the L1 instruction victim cache, 0 for none",
+	      &il1_victim, /* default */VICTIM_SIZE,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:dl1:victim",
+	      "lines of the L1 data victim cache, 0 for none",
+	      &dl1_victim, /* default */VICTIM_SIZE,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_flag(odb, "-cache:il1:mrc",
+	       "profile the LRU miss ratio curve of the L1 instruction cache",
+	       &il1_mrc, /* default */FALSE,
+	       /* print */TRUE, /* format */NULL);
+  opt_reg_flag(odb, "-cache:dl1:mrc",
+	       "profile the LRU miss ratio curve of the L1 data cache",
+	       &dl1_mrc, /* default */FALSE,
+	       /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:mrc:sets",
+	      "largest number of sets of a miss ratio curve",
+	      &mrc_sets, /* default */MRC_SETS,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-cache:mrc:ways",
+	      "largest associativity of a miss ratio curve",
+	      &mrc_ways, /* default */MRC_WAYS,
+	      /* print */TRUE, /* format */NULL);
+}
+
+/* check the geometry options of one cache level */
+static void
+check_cache_options(char *name, int size, int assoc, int line, char *repl)
+{
+  if (line < (int)sizeof(md_inst_t) || (line & (line - 1)))
+    fatal("%s line size must be a power of two, at least %d bytes",
+	  name, (int)sizeof(md_inst_t));
+  if (assoc < 1 || assoc > 32 || (assoc & (assoc - 1)))
+    fatal("%s associativity must be a power of two, at most 32", name);
+  if (size < line * assoc || (size & (size - 1)))
+    fatal("%s size must be a power of two, at least line size * "
+	  "associativity bytes", name);
+  if (!repl_lookup(repl))
+    fatal("unknown %s replacement policy `%s'", name, repl);
+}
+
+/* parse the L2 inclusion option */
+static enum cache_incl
+incl_lookup(char *name)
+{
+  if (!strcmp(name, "nine"))
+    return INCL_NINE;
+  if (!strcmp(name, "inclusive"))
+    return INCL_INCLUSIVE;
+  if (!strcmp(name, "exclusive"))
+    return INCL_EXCLUSIVE;
+  fatal("unknown L2 inclusion `%s'", name);
+}
+
+/* check the options of the cache hierarchy */
+void
+cache_check_options()
+{
+  check_cache_options("L1 cache", cache_size, cache_assoc, cache_line,
+		      cache_repl);
+  if (l2_size) {
+    check_cache_options("L2 cache", l2_size, l2_assoc, l2_line, l2_repl);
+    if (incl_lookup(l2_incl) == INCL_EXCLUSIVE ? l2_line != cache_line
+	: l2_line < cache_line)
+      fatal("L2 line size must be at least the L1 line size, or equal to it "
+	    "for an exclusive L2");
+  }
+  if (l2_lat < 0 || mem_lat < 0)
+    fatal("cache latencies must not be negative");
+  if (strcmp(il1_pf, "none") && !pf_lookup(il1_pf))
+    fatal("unknown L1 instruction cache prefetcher `%s'", il1_pf);
+  if (strcmp(dl1_pf, "none") && !pf_lookup(dl1_pf))
+    fatal("unknown L1 data cache prefetcher `%s'", dl1_pf);
+  if (pf_degree < 1 || pf_streams < 1 || pf_depth < 1)
+    fatal("prefetch degree, stream buffers and depth must be at least 1");
+  if (pf_rpt < 1 || (pf_rpt & (pf_rpt - 1)))
+    fatal("stride prefetcher table size must be a power of two");
+  if (dl1_mshr < 0)
+    fatal("number of MSHRs must not be negative");
+  if (strcmp(dl1_write, "back") && strcmp(dl1_write, "through"))
+    fatal("unknown L1 data cache write policy `%s'", dl1_write);
+  if (wbuf_size < 0)
+    fatal("write buffer size must not be negative");
+  if (il1_victim < 0 || il1_victim > 32 || dl1_victim < 0 || dl1_victim > 32)
+    fatal("victim cache size must be between 0 and 32 lines");
+  if (mrc_sets < 1 || (mrc_sets & (mrc_sets - 1))
+      || mrc_ways < 1 || (mrc_ways & (mrc_ways - 1)) || mrc_ways > 256)
+    fatal("miss ratio curve sets and ways must be powers of two, at most "
+	  "256 ways");
+}
+
+void cache_init(struct mem_t* mp) {
+  mem = mp;
+  cache_create(&il1, "il1", cache_size, cache_assoc, cache_line,
+               repl_lookup(cache_repl));
+  cache_create(&dl1, "dl1", cache_size, cache_assoc, cache_line,
+               repl_lookup(cache_repl));
+  il1.mem_lat = dl1.mem_lat = mem_lat;
+  if (l2_size) {
+    cache_create(&l2, "l2", l2_size, l2_assoc, l2_line, repl_lookup(l2_repl));
+    l2.hit_lat = l2_lat;
+    l2.mem_lat = mem_lat;
+    l2.incl = incl_lookup(l2_incl);
+    cache_link(&il1, &l2);
+    cache_link(&dl1, &l2);
+  }
+  il1.pf_degree = dl1.pf_degree = pf_degree;
+  il1.pf_rpt = dl1.pf_rpt = pf_rpt;
+  il1.pf_streams = dl1.pf_streams = pf_streams;
+  il1.pf_depth = dl1.pf_depth = pf_depth;
+  if (strcmp(il1_pf, "none"))
+    cache_set_prefetcher(&il1, pf_lookup(il1_pf));
+  if (strcmp(dl1_pf, "none"))
+    cache_set_prefetcher(&dl1, pf_lookup(dl1_pf));
+  if (dl1_mshr)
+    cache_set_mshr(&dl1, dl1_mshr);
+  dl1.walloc = dl1_walloc;
+  dl1.wthrough = !strcmp(dl1_write, "through");
+  if (wbuf_size) {
+    cache_set_wbuf(&dl1, wbuf_size);
+    if (l2_size)
+      cache_set_wbuf(&l2, wbuf_size);
+  }
+  if (il1_victim)
+    cache_set_victim(&il1, il1_victim);
+  if (dl1_victim)
+    cache_set_victim(&dl1, dl1_victim);
+  if (il1_mrc)
+    cache_set_mrc(&il1, mrc_sets, mrc_ways);
+  if (dl1_mrc)
+    cache_set_mrc(&dl1, mrc_sets, mrc_ways);
+}
+
+/* cahce */
+
+void cache_create(struct cache* cp, char* name, unsigned int size, unsigned int assoc,
+                  unsigned int line, struct repl_policy* policy) {
+  unsigned int nlines = size / line;
+  unsigned int i;
+
+  cp->name = name;
+  cp->nsets = nlines / assoc;
+  cp->assoc = assoc;
+  cp->line_words = line / sizeof(word_t);
+  cp->line_shift = log_base2(line);
+  cp->assoc_shift = log_base2(assoc);
+  cp->tag_shift = cp->line_shift + log_base2(cp->nsets);
+  cp->offset_mask = line - 1;
+  cp->idx_mask = cp->nsets - 1;
+  cp->full_mask = assoc == 32 ? ~0u : (1u << assoc) - 1;
+
+  cp->tags = calloc(nlines, sizeof(unsigned int));
+  cp->data = calloc(nlines * cp->line_words, sizeof(word_t));
+  cp->valid = calloc(cp->nsets, sizeof(unsigned int));
+  cp->dirty = calloc(cp->nsets, sizeof(unsigned int));
+  cp->pref = calloc(cp->nsets, sizeof(unsigned int));
+  cp->ready = calloc(nlines, sizeof(unsigned int));
+  if (!cp->tags || !cp->data || !cp->valid || !cp->dirty || !cp->pref
+      || !cp->ready)
+    fatal("out of virtual memory");
+
+  /* LRU ranks are rounded up to a power of two bits so they never
+     straddle two state words */
+  for (cp->rank_bits = 1; (1u << cp->rank_bits) < assoc; cp->rank_bits <<= 1)
+    ;
+  cp->policy = policy;
+  cp->fills = 0;
+  cp->repl_words = policy->words(cp);
+  cp->repl = calloc(cp->nsets * cp->repl_words + 1, sizeof(unsigned int));
+  if (!cp->repl)
+    fatal("out of virtual memory");
+  for (i = 0; i < cp->nsets; ++i) {
+    policy->init(cp, cp->repl + i * cp->repl_words);
+  }
+
+  cp->hit_lat = HIT_LATENCY;
+  cp->mem_lat = MEM_LATENCY;
+  cp->next = NULL;
+  cp->nabove = 0;
+  cp->incl = INCL_NINE;
+  cp->pf = NULL;
+  cp->pf_state = NULL;
+  cp->nmshr = 0;
+  cp->mshr = NULL;
+  cp->done = 0;
+  cp->walloc = TRUE;
+  cp->wthrough = FALSE;
+  cp->nwbuf = 0;
+  cp->wbuf = NULL;
+  cp->wbuf_tail = 0;
+  cp->wstall = 0;
+  cp->nvictim = 0;
+  cp->vc_valid = 0;
+  cp->vc_dirty = 0;
+  cp->mrc = NULL;
+  cp->isEnabled = 1;
+  cp->accessCounter = 0;
+  cp->hitCounter = 0;
+  cp->missCounter = 0;
+  cp->replaceCounter = 0;
+  cp->wbCounter = 0;
+  cp->pfIssueCounter = 0;
+  cp->pfUsefulCounter = 0;
+  cp->pfLateCounter = 0;
+  cp->pfUselessCounter = 0;
+  cp->mshrMergeCounter = 0;
+  cp->mshrFullCounter = 0;
+  cp->mshrStallCounter = 0;
+  cp->wtCounter = 0;
+  cp->wbufMergeCounter = 0;
+  cp->wbufFullCounter = 0;
+  cp->wbufStallCounter = 0;
+  cp->victimHitCounter = 0;
+}
+
+void cache_link(struct cache* upper, struct cache* lower) {
+  upper->next = lower;
+  lower->above[lower->nabove++] = upper;
+}
+
+void cache_do_read(struct cache* cp, unsigned int line, unsigned int offset, word_t* dst) {
+  memcpy(dst, (void *)(cp->data + line * cp->line_words) + offset, sizeof(word_t));
+}
+
+void cache_do_write(struct cache* cp, unsigned int line, unsigned int offset, word_t* src) {
+  memcpy((void *)(cp->data + line * cp->line_words) + offset, src, sizeof(word_t));
+  cp->dirty[line >> cp->assoc_shift] |= 1u << (line & (cp->assoc - 1));
+}
+
+void cache_do_write_through(struct cache* cp, unsigned int line, unsigned int offset, word_t* src) {
+  memcpy((void *)(cp->data + line * cp->line_words) + offset, src, sizeof(word_t));
+}
+
+unsigned int cache_access(struct cache* cp, md_addr_t addr, md_addr_t pc, word_t* wp, cache_func func) {
+  unsigned int tag = ADDR_TAG(cp, addr);
+  unsigned int idx = ADDR_IDX(cp, addr);
+  unsigned int offset = ADDR_OFFSET(cp, addr);
+
+  unsigned int* tags = cp->tags + LINE_IDX(cp, idx, 0);
+  unsigned int valid = cp->valid[idx];
+  unsigned int assoc = cp->assoc;
+  unsigned int way, line, cycles, wait, i;
+  int trigger, v;
+
+  ++cp->accessCounter;
+  if (cp->mrc)
+    cache_mrc_access(cp, addr);
+
+  for (way = 0; way < assoc; ++way) {
+    if (tag == tags[way] && (valid & (1u << way))) {
+      ++cp->hitCounter;
+      if (cp->policy->hit)
+        cp->policy->hit(cp, cp->repl + idx * cp->repl_words, way);
+      func(cp, LINE_IDX(cp, idx, way), offset, wp);
+      if (!cp->pf && !cp->nmshr)
+        return cp->hit_lat;
+      cycles = cp->hit_lat;
+      line = LINE_IDX(cp, idx, way);
+      trigger = FALSE;
+      if (cp->pref[idx] & (1u << way)) {
+        /* first demand use of a prefetched line */
+        cp->pref[idx] &= ~(1u << way);
+        ++cp->pfUsefulCounter;
+        if (cp->ready[line] > sim_num_cycle)
+          ++cp->pfLateCounter;
+        trigger = TRUE;
+      }
+      cp->done = sim_num_cycle + cycles;
+      if (cp->ready[line] > sim_num_cycle) {
+        /* the line is still on its way: merge into its MSHR, or wait */
+        if (cp->nmshr) {
+          ++cp->mshrMergeCounter;
+          cp->done = cp->ready[line];
+        } else {
+          cycles += cp->ready[line] - sim_num_cycle;
+        }
+      }
+      if (cp->pf && cp->pf->access)
+        cp->pf->access(cp, addr, pc, trigger);
+      return cycles;
+    }
+  }
+
+  ++cp->missCounter;
+  if (cp->nvictim && (v = cache_victim_probe(cp, ADDR_ALIGN(cp, addr))) >= 0) {
+    /* a conflict miss caught by the victim cache, swap the line back in */
+    ++cp->victimHitCounter;
+    way = cache_victim_swap(cp, idx, v, addr);
+    line = LINE_IDX(cp, idx, way);
+    cycles = cp->hit_lat + VICTIM_LATENCY;
+    cp->done = sim_num_cycle + cycles;
+    goto ACCESS_DONE;
+  }
+  way = add_cache_line(cp, idx);
+  line = LINE_IDX(cp, idx, way);
+  cycles = cache_fill_line(cp, idx, way, ADDR_ALIGN(cp, addr));
+  if (cp->pf && cp->pf->miss && cp->pf->miss(cp, ADDR_ALIGN(cp, addr), &wait)) {
+    /* the prefetcher already asked for the line, only the rest is waited */
+    cycles = wait;
+  }
+  if (cp->nmshr) {
+    /* the requester only waits when every MSHR is busy */
+    i = cache_mshr_next(cp);
+    wait = 0;
+    if (cp->mshr[i] > sim_num_cycle) {
+      wait = cp->mshr[i] - sim_num_cycle;
+      ++cp->mshrFullCounter;
+      cp->mshrStallCounter += wait;
+    }
+    cp->done = cp->mshr[i] = cp->ready[line] =
+      sim_num_cycle + wait + cp->hit_lat + cycles;
+    cycles = cp->hit_lat + wait;
+  } else {
+    cycles += cp->hit_lat;
+    cp->done = sim_num_cycle + cycles;
+  }
+ACCESS_DONE:
+  /* the victim may have waited for the write buffer */
+  cycles += cp->wstall;
+  cp->wstall = 0;
+  func(cp, line, offset, wp);
+  if (cp->pf && cp->pf->access)
+    cp->pf->access(cp, addr, pc, TRUE);
+  return cycles;
+}
+
+unsigned int cache_read(struct cache* cp, md_addr_t addr, md_addr_t pc, word_t* wp) {
+  return cache_access(cp, addr, pc, wp, cache_do_read);
+}
+
+unsigned int cache_write(struct cache* cp, md_addr_t addr, md_addr_t pc, word_t* wp) {
+  unsigned int cycles;
+  if (!cp->walloc && cache_probe(cp, ADDR_IDX(cp, addr), ADDR_TAG(cp, addr)) < 0
+      && (!cp->nvictim || cache_victim_probe(cp, ADDR_ALIGN(cp, addr)) < 0)) {
+    /* no-write-allocate: a store miss goes around the cache */
+    ++cp->accessCounter;
+    if (cp->mrc)
+      cache_mrc_access(cp, addr);
+    ++cp->missCounter;
+    ++cp->wtCounter;
+    cache_write_next(cp, addr, wp);
+    cycles = cp->hit_lat + cache_wbuf_put(cp, addr);
+    cp->done = sim_num_cycle + cycles;
+    return cycles;
+  }
+  if (!cp->wthrough)
+    return cache_access(cp, addr, pc, wp, cache_do_write);
+  /* write-through: the line stays clean and the word goes down too */
+  cycles = cache_access(cp, addr, pc, wp, cache_do_write_through);
+  ++cp->wtCounter;
+  cache_write_next(cp, addr, wp);
+  return cycles + cache_wbuf_put(cp, addr);
+}
+
+int cache_probe(struct cache* cp, unsigned int idx, unsigned int tag) {
+  unsigned int* tags = cp->tags + LINE_IDX(cp, idx, 0);
+  unsigned int way;
+  for (way = 0; way < cp->assoc; ++way) {
+    if (tag == tags[way] && (cp->valid[idx] & (1u << way)))
+      return way;
+  }
+  return -1;
+}
+
+unsigned int cache_get_line(struct cache* cp, md_addr_t addr, word_t* dst, unsigned int nwords, int* dirty) {
+  unsigned int idx = ADDR_IDX(cp, addr);
+  unsigned int words = ADDR_OFFSET(cp, addr) / sizeof(word_t);
+  int way = cache_probe(cp, idx, ADDR_TAG(cp, addr));
+  unsigned int cycles;
+  enum md_fault_type _fault;
+  int i;
+
+  ++cp->accessCounter;
+  *dirty = FALSE;
+
+  if (way >= 0) {
+    ++cp->hitCounter;
+    if (cp->policy->hit)
+      cp->policy->hit(cp, cp->repl + idx * cp->repl_words, way);
+    memcpy(dst, cp->data + LINE_IDX(cp, idx, way) * cp->line_words + words,
+           nwords * sizeof(word_t));
+    if (cp->incl == INCL_EXCLUSIVE) {
+      /* the line moves up, taking its dirty data with it */
+      *dirty = (cp->dirty[idx] >> way) & 1;
+      cp->valid[idx] &= ~(1u << way);
+      cp->dirty[idx] &= ~(1u << way);
+    }
+    return cp->hit_lat;
+  }
+
+  ++cp->missCounter;
+  if (cp->incl == INCL_EXCLUSIVE) {
+    /* lines only come in as victims from above, fetch around this level */
+    if (cp->next)
+      return cp->hit_lat + cache_get_line(cp->next, addr, dst, nwords, dirty);
+    for (i = 0; i < nwords; ++i) {
+      dst[i] = READ_WORD(addr + (i * 4), _fault);
+    }
+    return cp->hit_lat + cp->mem_lat;
+  }
+  way = add_cache_line(cp, idx);
+  cycles = cp->hit_lat + cache_fill_line(cp, idx, way, ADDR_ALIGN(cp, addr));
+  cycles += cp->wstall;
+  cp->wstall = 0;
+  memcpy(dst, cp->data + LINE_IDX(cp, idx, way) * cp->line_words + words,
+         nwords * sizeof(word_t));
+  return cycles;
+}
+
+void cache_put_line(struct cache* cp, md_addr_t addr, word_t* src, unsigned int nwords, int dirty) {
+  unsigned int idx = ADDR_IDX(cp, addr);
+  unsigned int words = ADDR_OFFSET(cp, addr) / sizeof(word_t);
+  int way = cache_probe(cp, idx, ADDR_TAG(cp, addr));
+
+  ++cp->accessCounter;
+
+  if (way >= 0) {
+    ++cp->hitCounter;
+  } else {
+    ++cp->missCounter;
+    way = add_cache_line(cp, idx);
+    if (nwords < cp->line_words)
+      cache_fill_line(cp, idx, way, ADDR_ALIGN(cp, addr));
+    else
+      cache_install(cp, idx, way, addr);
+  }
+  memcpy(cp->data + LINE_IDX(cp, idx, way) * cp->line_words + words, src,
+         nwords * sizeof(word_t));
+  if (dirty)
+    cp->dirty[idx] |= 1u << way;
+  /* a victim of a write from above waits in the write buffer, not in the
+     pipeline */
+  cp->wstall = 0;
+}
+
+void cache_install(struct cache* cp, unsigned int idx, unsigned int way, md_addr_t addr) {
+  cp->tags[LINE_IDX(cp, idx, way)] = ADDR_TAG(cp, addr);
+  cp->valid[idx] |= 1u << way;
+  cp->dirty[idx] &= ~(1u << way);
+  cp->pref[idx] &= ~(1u << way);
+  cp->ready[LINE_IDX(cp, idx, way)] = 0;
+  ++cp->fills;
+  if (cp->policy->fill)
+    cp->policy->fill(cp, cp->repl + idx * cp->repl_words, way);
+}
+
+unsigned int cache_fill_line(struct cache* cp, unsigned int idx, unsigned int way, md_addr_t addr) {
+  unsigned int line = LINE_IDX(cp, idx, way);
+  word_t* lp = cp->data + line * cp->line_words;
+  unsigned int cycles;
+  int dirty = FALSE;
+  enum md_fault_type _fault;
+  int i;
+  if (cp->next) {
+    cycles = cache_get_line(cp->next, addr, lp, cp->line_words, &dirty);
+  } else {
+    for (i = 0; i < cp->line_words; ++i) {
+      lp[i] = READ_WORD(addr + (i * 4), _fault);
+    }
+    cycles = cp->mem_lat;
+  }
+  cache_install(cp, idx, way, addr);
+  if (dirty)
+    cp->dirty[idx] |= 1u << way;
+  return cycles;
+}
+
+void cache_write_back(struct cache* cp, unsigned int idx, unsigned int way) {
+  unsigned int line = LINE_IDX(cp, idx, way);
+  word_t* lp = cp->data + line * cp->line_words;
+  md_addr_t addr = (cp->tags[line] << cp->tag_shift) | (idx << cp->line_shift);
+  if (cp->next) {
+    cache_put_line(cp->next, addr, lp, cp->line_words, TRUE);
+  } else {
+    cache_write_mem(lp, addr, cp->line_words);
+  }
+  cp->dirty[idx] &= ~(1u << way);
+}
+
+void cache_write_mem(word_t* lp, md_addr_t addr, unsigned int nwords) {
+  enum md_fault_type _fault;
+  int i;
+  for (i = 0; i < nwords; ++i) {
+    WRITE_WORD(lp[i], addr + (i * 4), _fault);
+  }
+}
+
+void cache_write_next(struct cache* cp, md_addr_t addr, word_t* wp) {
+  struct cache* np = cp->next;
+  /* an exclusive level only takes the word if it already holds the line,
+     it must not get a copy of a line of this one */
+  if (np && (np->incl != INCL_EXCLUSIVE
+             || cache_probe(np, ADDR_IDX(np, addr), ADDR_TAG(np, addr)) >= 0))
+    cache_put_line(np, addr, wp, 1, TRUE);
+  else
+    cache_write_mem(wp, addr, 1);
+}
+
+unsigned int cache_fetch_latency(struct cache* cp, md_addr_t addr) {
+  struct cache* lp = cp->next;
+  if (!lp)
+    return cp->mem_lat;
+  if (cache_probe(lp, ADDR_IDX(lp, addr), ADDR_TAG(lp, addr)) >= 0)
+    return lp->hit_lat;
+  return lp->hit_lat + cache_fetch_latency(lp, addr);
+}
+
+void cache_prefetch(struct cache* cp, md_addr_t addr) {
+  unsigned int idx = ADDR_IDX(cp, addr);
+  unsigned int way, i = 0;
+  if (cache_probe(cp, idx, ADDR_TAG(cp, addr)) >= 0)
+    return;
+  if (cp->nvictim && cache_victim_probe(cp, ADDR_ALIGN(cp, addr)) >= 0)
+    return;
+  if (cp->nmshr) {
+    /* a prefetch never waits for an MSHR, it is dropped instead */
+    i = cache_mshr_next(cp);
+    if (cp->mshr[i] > sim_num_cycle)
+      return;
+  }
+  way = add_cache_line(cp, idx);
+  cp->ready[LINE_IDX(cp, idx, way)] =
+    sim_num_cycle + cache_fill_line(cp, idx, way, ADDR_ALIGN(cp, addr));
+  if (cp->nmshr)
+    cp->mshr[i] = cp->ready[LINE_IDX(cp, idx, way)];
+  /* nobody waits for the victim of a prefetch */
+  cp->wstall = 0;
+  cp->pref[idx] |= 1u << way;
+  ++cp->pfIssueCounter;
+}
+
+void cache_write_victim(struct cache* cp, md_addr_t addr, word_t* lp, int dirty) {
+  if (dirty) {
+    ++cp->wbCounter;
+    if (cp->next)
+      cache_put_line(cp->next, addr, lp, cp->line_words, TRUE);
+    else
+      cache_write_mem(lp, addr, cp->line_words);
+  } else if (cp->next && cp->next->incl == INCL_EXCLUSIVE) {
+    /* an exclusive next level keeps the clean victims too */
+    cache_put_line(cp->next, addr, lp, cp->line_words, FALSE);
+  } else {
+    return;
+  }
+  cp->wstall += cache_wbuf_put(cp, addr);
+}
+
+void cache_evict(struct cache* cp, unsigned int idx, unsigned int way) {
+  unsigned int line = LINE_IDX(cp, idx, way);
+  md_addr_t addr = (cp->tags[line] << cp->tag_shift) | (idx << cp->line_shift);
+  if (cp->pref[idx] & (1u << way)) {
+    ++cp->pfUselessCounter;
+    cp->pref[idx] &= ~(1u << way);
+  }
+  if (cp->incl == INCL_INCLUSIVE)
+    cache_back_invalidate(cp, idx, way);
+  if (cp->nvictim) {
+    /* the line waits in the victim cache before leaving */
+    cache_victim_put(cp, idx, way);
+  } else {
+    cache_write_victim(cp, addr, cp->data + line * cp->line_words,
+                       (cp->dirty[idx] >> way) & 1);
+    cp->dirty[idx] &= ~(1u << way);
+  }
+  cp->valid[idx] &= ~(1u << way);
+}
+
+void cache_back_invalidate(struct cache* cp, unsigned int idx, unsigned int way) {
+  unsigned int line = LINE_IDX(cp, idx, way);
+  md_addr_t base = (cp->tags[line] << cp->tag_shift) | (idx << cp->line_shift);
+  md_addr_t addr;
+  struct cache* up;
+  unsigned int i, uidx;
+  int uway;
+  for (i = 0; i < cp->nabove; ++i) {
+    up = cp->above[i];
+    for (addr = base; addr <= base + cp->offset_mask; addr += up->offset_mask + 1) {
+      /* a copy in the victim cache above is dropped the same way */
+      if (up->nvictim && (uway = cache_victim_probe(up, addr)) >= 0) {
+        if (up->vc_dirty & (1u << uway)) {
+          memcpy(cp->data + line * cp->line_words + (addr - base) / sizeof(word_t),
+                 up->vc_data + uway * up->line_words,
+                 up->line_words * sizeof(word_t));
+          cp->dirty[idx] |= 1u << way;
+        }
+        up->vc_valid &= ~(1u << uway);
+        up->vc_dirty &= ~(1u << uway);
+        continue;
+      }
+      uidx = ADDR_IDX(up, addr);
+      uway = cache_probe(up, uidx, ADDR_TAG(up, addr));
+      if (uway < 0)
+        continue;
+      if (up->dirty[uidx] & (1u << uway)) {
+        memcpy(cp->data + line * cp->line_words + (addr - base) / sizeof(word_t),
+               up->data + LINE_IDX(up, uidx, uway) * up->line_words,
+               up->line_words * sizeof(word_t));
+        cp->dirty[idx] |= 1u << way;
+      }
+      if (up->pref[uidx] & (1u << uway))
+        ++up->pfUselessCounter;
+      up->valid[uidx] &= ~(1u << uway);
+      up->dirty[uidx] &= ~(1u << uway);
+      up->pref[uidx] &= ~(1u << uway);
+    }
+  }
+}
+
+unsigned int add_cache_line(struct cache* cp, unsigned int idx) {
+  unsigned int way;
+  if (cp->valid[idx] != cp->full_mask) {
+    /* fill an invalid way first */
+    for (way = 0; cp->valid[idx] & (1u << way); ++way)
+      ;
+    return way;
+  }
+  way = cp->policy->victim(cp, cp->repl + idx * cp->repl_words);
+  ++cp->replaceCounter;
+  cache_evict(cp, idx, way);
+  return way;
+}
+
+/* replacement policies */
+
+/* get/set the N-th BITS-wide field of a bit-packed state, BITS must be a
+   power of two no larger than 32 */
+#define REPL_FIELD_MASK(BITS) ((BITS) == 32 ? ~0u : (1u << (BITS)) - 1)
+#define REPL_GET(ST, N, BITS) \
+  (((ST)[((N) * (BITS)) >> 5] >> (((N) * (BITS)) & 31)) & REPL_FIELD_MASK(BITS))
+#define REPL_SET(ST, N, BITS, V) \
+  ((ST)[((N) * (BITS)) >> 5] = ((ST)[((N) * (BITS)) >> 5] \
+    & ~(REPL_FIELD_MASK(BITS) << (((N) * (BITS)) & 31))) \
+    | ((V) << (((N) * (BITS)) & 31)))
+
+unsigned int repl_one_word(struct cache* cp) {
+  return 1;
+}
+
+/* FIFO: the state is the ring-buffer head, the oldest way */
+void fifo_init(struct cache* cp, unsigned int* st) {
+  st[0] = 0;
+}
+
+unsigned int fifo_victim(struct cache* cp, unsigned int* st) {
+  unsigned int way = st[0];
+  st[0] = (way + 1) & (cp->assoc - 1);
+  return way;
+}
+
+/* LRU: a rank_bits-wide recency rank per way, 0 is the most recently used */
+unsigned int lru_words(struct cache* cp) {
+  return (cp->assoc * cp->rank_bits + 31) / 32;
+}
+
+void lru_init(struct cache* cp, unsigned int* st) {
+  unsigned int way;
+  /* ranks start as a permutation, so filling in way order leaves way 0
+     as the least recently used */
+  for (way = 0; way < cp->assoc; ++way) {
+    REPL_SET(st, way, cp->rank_bits, way);
+  }
+}
+
+void lru_touch(struct cache* cp, unsigned int* st, unsigned int way) {
+  unsigned int rank = REPL_GET(st, way, cp->rank_bits);
+  unsigned int w, r;
+  if (rank == 0)
+    return;
+  for (w = 0; w < cp->assoc; ++w) {
+    r = REPL_GET(st, w, cp->rank_bits);
+    if (r < rank)
+      REPL_SET(st, w, cp->rank_bits, r + 1);
+  }
+  REPL_SET(st, way, cp->rank_bits, 0);
+}
+
+unsigned int lru_victim(struct cache* cp, unsigned int* st) {
+  unsigned int way;
+  for (way = 0; REPL_GET(st, way, cp->rank_bits) != cp->assoc - 1; ++way)
+    ;
+  return way;
+}
+
+/* tree pseudo-LRU: assoc - 1 node bits of a binary tree in heap order,
+   each pointing toward the less recently used half */
+void plru_init(struct cache* cp, unsigned int* st) {
+  st[0] = 0;
+}
+
+void plru_touch(struct cache* cp, unsigned int* st, unsigned int way) {
+  unsigned int node = way + cp->assoc - 1;
+  unsigned int parent;
+  while (node) {
+    parent = (node - 1) >> 1;
+    /* point the parent away from the accessed child */
+    if (node == 2 * parent + 1)
+      st[0] |= 1u << parent;
+    else
+      st[0] &= ~(1u << parent);
+    node = parent;
+  }
+}
+
+unsigned int plru_victim(struct cache* cp, unsigned int* st) {
+  unsigned int node = 0;
+  while (node < cp->assoc - 1) {
+    node = 2 * node + 1 + ((st[0] >> node) & 1);
+  }
+  return node - (cp->assoc - 1);
+}
+
+/* SRRIP/BRRIP: a 2-bit re-reference prediction value per way */
+unsigned int rrip_words(struct cache* cp) {
+  return (cp->assoc * 2 + 31) / 32;
+}
+
+void rrip_init(struct cache* cp, unsigned int* st) {
+  unsigned int way;
+  for (way = 0; way < cp->assoc; ++way) {
+    REPL_SET(st, way, 2, RRPV_MAX);
+  }
+}
+
+void rrip_hit(struct cache* cp, unsigned int* st, unsigned int way) {
+  REPL_SET(st, way, 2, 0);
+}
+
+void srrip_fill(struct cache* cp, unsigned int* st, unsigned int way) {
+  REPL_SET(st, way, 2, RRPV_MAX - 1);
+}
+
+void brrip_fill(struct cache* cp, unsigned int* st, unsigned int way) {
+  REPL_SET(st, way, 2, cp->fills % RRIP_THROTTLE ? RRPV_MAX : RRPV_MAX - 1);
+}
+
+unsigned int rrip_victim(struct cache* cp, unsigned int* st) {
+  unsigned int way;
+  while (TRUE) {
+    for (way = 0; way < cp->assoc; ++way) {
+      if (REPL_GET(st, way, 2) == RRPV_MAX)
+        return way;
+    }
+    /* nobody is predicted distant, age the whole set */
+    for (way = 0; way < cp->assoc; ++way) {
+      REPL_SET(st, way, 2, REPL_GET(st, way, 2) + 1);
+    }
+  }
+}
+
+/* random: no state */
+unsigned int repl_no_words(struct cache* cp) {
+  return 0;
+}
+
+void random_init(struct cache* cp, unsigned int* st) {
+}
+
+unsigned int random_victim(struct cache* cp, unsigned int* st) {
+  return myrand() & (cp->assoc - 1);
+}
+
+static struct repl_policy repl_policies[] = {
+  { "fifo", repl_one_word, fifo_init, NULL, NULL, fifo_victim },
+  { "lru", lru_words, lru_init, lru_touch, lru_touch, lru_victim },
+  { "plru", repl_one_word, plru_init, plru_touch, plru_touch, plru_victim },
+  { "srrip", rrip_words, rrip_init, rrip_hit, srrip_fill, rrip_victim },
+  { "brrip", rrip_words, rrip_init, rrip_hit, brrip_fill, rrip_victim },
+  { "random", repl_no_words, random_init, NULL, NULL, random_victim },
+};
+
+struct repl_policy* repl_lookup(char* name) {
+  int i;
+  for (i = 0; i < N_ELT(repl_policies); ++i) {
+    if (!strcmp(repl_policies[i].name, name))
+      return &repl_policies[i];
+  }
+  return NULL;
+}
+
+void cache_set_mshr(struct cache* cp, unsigned int nmshr) {
+  cp->nmshr = nmshr;
+  cp->mshr = calloc(nmshr, sizeof(unsigned int));
+  if (!cp->mshr)
+    fatal("out of virtual memory");
+}
+
+unsigned int cache_mshr_next(struct cache* cp) {
+  unsigned int i, first = 0;
+  for (i = 1; i < cp->nmshr; ++i) {
+    if (cp->mshr[i] < cp->mshr[first])
+      first = i;
+  }
+  return first;
+}
+
+void cache_set_wbuf(struct cache* cp, unsigned int nwbuf) {
+  cp->nwbuf = nwbuf;
+  cp->wbuf = calloc(nwbuf, sizeof(struct wbuf_entry));
+  if (!cp->wbuf)
+    fatal("out of virtual memory");
+}
+
+unsigned int cache_wbuf_put(struct cache* cp, md_addr_t addr) {
+  unsigned int wlat = cp->next ? cp->next->hit_lat : cp->mem_lat;
+  struct wbuf_entry* ep = cp->wbuf;
+  unsigned int i, first = 0, stall = 0;
+
+  /* without a buffer the writer waits for the next level */
+  if (!cp->nwbuf)
+    return wlat;
+
+  addr = ADDR_ALIGN(cp, addr);
+  for (i = 0; i < cp->nwbuf; ++i) {
+    if (ep[i].drain > sim_num_cycle && ep[i].addr == addr) {
+      ++cp->wbufMergeCounter;
+      return 0;
+    }
+    if (ep[i].drain < ep[first].drain)
+      first = i;
+  }
+  if (ep[first].drain > sim_num_cycle) {
+    /* full, wait for the oldest write to drain */
+    stall = ep[first].drain - sim_num_cycle;
+    ++cp->wbufFullCounter;
+    cp->wbufStallCounter += stall;
+  }
+  /* the buffer drains one write at a time */
+  if (cp->wbuf_tail < sim_num_cycle + stall)
+    cp->wbuf_tail = sim_num_cycle + stall;
+  cp->wbuf_tail += wlat;
+  ep[first].addr = addr;
+  ep[first].drain = cp->wbuf_tail;
+  return stall;
+}
+
+void cache_set_victim(struct cache* cp, unsigned int nvictim) {
+  cp->nvictim = nvictim;
+  cp->vc_full = nvictim == 32 ? ~0u : (1u << nvictim) - 1;
+  cp->vc_addr = calloc(nvictim, sizeof(md_addr_t));
+  cp->vc_stamp = calloc(nvictim, sizeof(unsigned int));
+  cp->vc_data = calloc(nvictim * cp->line_words, sizeof(word_t));
+  cp->vc_tmp = calloc(cp->line_words, sizeof(word_t));
+  if (!cp->vc_addr || !cp->vc_stamp || !cp->vc_data || !cp->vc_tmp)
+    fatal("out of virtual memory");
+}
+
+int cache_victim_probe(struct cache* cp, md_addr_t addr) {
+  unsigned int v;
+  for (v = 0; v < cp->nvictim; ++v) {
+    if (cp->vc_addr[v] == addr && (cp->vc_valid & (1u << v)))
+      return v;
+  }
+  return -1;
+}
+
+void cache_victim_put(struct cache* cp, unsigned int idx, unsigned int way) {
+  unsigned int line = LINE_IDX(cp, idx, way);
+  unsigned int v, oldest = 0;
+  if (cp->vc_valid != cp->vc_full) {
+    for (v = 0; cp->vc_valid & (1u << v); ++v)
+      ;
+  } else {
+    for (v = 1; v < cp->nvictim; ++v) {
+      if (cp->vc_stamp[v] < cp->vc_stamp[oldest])
+        oldest = v;
+    }
+    v = oldest;
+    cache_write_victim(cp, cp->vc_addr[v], cp->vc_data + v * cp->line_words,
+                       (cp->vc_dirty >> v) & 1);
+  }
+  cp->vc_addr[v] = (cp->tags[line] << cp->tag_shift) | (idx << cp->line_shift);
+  cp->vc_stamp[v] = cp->accessCounter;
+  memcpy(cp->vc_data + v * cp->line_words, cp->data + line * cp->line_words,
+         cp->line_words * sizeof(word_t));
+  cp->vc_valid |= 1u << v;
+  if (cp->dirty[idx] & (1u << way))
+    cp->vc_dirty |= 1u << v;
+  else
+    cp->vc_dirty &= ~(1u << v);
+  cp->dirty[idx] &= ~(1u << way);
+}
+
+unsigned int cache_victim_swap(struct cache* cp, unsigned int idx, unsigned int v, md_addr_t addr) {
+  int dirty = (cp->vc_dirty >> v) & 1;
+  unsigned int way;
+  /* free the slot first, so the victim of the set can take it */
+  memcpy(cp->vc_tmp, cp->vc_data + v * cp->line_words,
+         cp->line_words * sizeof(word_t));
+  cp->vc_valid &= ~(1u << v);
+  cp->vc_dirty &= ~(1u << v);
+  way = add_cache_line(cp, idx);
+  cache_install(cp, idx, way, addr);
+  memcpy(cp->data + LINE_IDX(cp, idx, way) * cp->line_words, cp->vc_tmp,
+         cp->line_words * sizeof(word_t));
+  if (dirty)
+    cp->dirty[idx] |= 1u << way;
+  return way;
+}
+
+/* stack distance profiles */
+
+void cache_set_mrc(struct cache* cp, unsigned int sets, unsigned int ways) {
+  struct mrc_prof* mp = calloc(1, sizeof(struct mrc_prof));
+  if (!mp)
+    fatal("out of virtual memory");
+  mp->nconf = log_base2(sets) + 1;
+  mp->depth = ways;
+  /* set counts 1, 2 .. sets take 2 * sets - 1 stacks in all */
+  mp->stack = calloc((2 * sets - 1) * ways, sizeof(md_addr_t));
+  mp->fill = calloc(2 * sets - 1, sizeof(unsigned int));
+  mp->hist = calloc(mp->nconf * (ways + 1), sizeof(counter_t));
+  if (!mp->stack || !mp->fill || !mp->hist)
+    fatal("out of virtual memory");
+  cp->mrc = mp;
+}
+
+void cache_mrc_access(struct cache* cp, md_addr_t addr) {
+  struct mrc_prof* mp = cp->mrc;
+  md_addr_t line = addr >> cp->line_shift;
+  unsigned int depth = mp->depth;
+  unsigned int k, set, n, d;
+  md_addr_t* st;
+
+  ++mp->refs;
+  for (k = 0; k < mp->nconf; ++k) {
+    /* the stacks of 1 << k sets start at stack (1 << k) - 1 */
+    set = (1u << k) - 1 + (line & ((1u << k) - 1));
+    st = mp->stack + set * depth;
+    n = mp->fill[set];
+    for (d = 0; d < n && st[d] != line; ++d)
+      ;
+    if (d == n) {
+      ++mp->hist[k * (depth + 1) + depth];
+      if (n < depth)
+        mp->fill[set] = n + 1;
+      else
+        --d;   /* the bottom line falls off */
+    } else {
+      ++mp->hist[k * (depth + 1) + d];
+    }
+    memmove(st + 1, st, d * sizeof(md_addr_t));
+    st[0] = line;
+  }
+}
+
+void cache_mrc_log(struct cache* cp) {
+  struct mrc_prof* mp = cp->mrc;
+  unsigned int k, ways, d;
+  counter_t misses;
+  for (k = 0; k < mp->nconf; ++k) {
+    counter_t* h = mp->hist + k * (mp->depth + 1);
+    for (ways = 1; ways <= mp->depth; ways <<= 1) {
+      /* an LRU cache of given ways misses every request deeper in its set */
+      misses = 0;
+      for (d = ways; d <= mp->depth; ++d)
+        misses += h[d];
+      printf("[%s] LRU misses of %u sets x %u ways (%u bytes): %lld (%.2f%%)\n",
+             cp->name, 1u << k, ways,
+             (1u << k) * ways * (1u << cp->line_shift), (long long)misses,
+             mp->refs ? 100.0 * misses / mp->refs : 0.0);
+    }
+  }
+}
+
+/* prefetchers */
+
+void cache_set_prefetcher(struct cache* cp, struct prefetcher* pf) {
+  cp->pf = pf;
+  cp->pf_state = calloc(1, pf->size(cp) + 1);
+  if (!cp->pf_state)
+    fatal("out of virtual memory");
+}
+
+/* next-line: on a miss or the first hit of a prefetched line (tagged
+   prefetch), fetch the pf_degree lines that follow */
+unsigned int pf_no_size(struct cache* cp) {
+  return 0;
+}
+
+void nextline_access(struct cache* cp, md_addr_t addr, md_addr_t pc, int trigger) {
+  unsigned int i;
+  if (!trigger)
+    return;
+  for (i = 1; i <= cp->pf_degree; ++i) {
+    cache_prefetch(cp, ADDR_ALIGN(cp, addr) + i * (cp->offset_mask + 1));
+  }
+}
+
+/* stride: a reference prediction table indexed by the pc of the access
+   learns its stride, the pf_degree next strides are fetched once the same
+   stride was seen twice in a row (Chen and Baer) */
+unsigned int stride_size(struct cache* cp) {
+  return cp->pf_rpt * sizeof(struct rpt_entry);
+}
+
+void stride_access(struct cache* cp, md_addr_t addr, md_addr_t pc, int trigger) {
+  struct rpt_entry* ep = (struct rpt_entry*)cp->pf_state
+    + ((pc / sizeof(md_inst_t)) & (cp->pf_rpt - 1));
+  int stride = addr - ep->last;
+  int correct = stride == ep->stride;
+  unsigned int i;
+
+  if (ep->pc != pc) {
+    ep->pc = pc;
+    ep->last = addr;
+    ep->stride = 0;
+    ep->state = RPT_INIT;
+    return;
+  }
+  switch (ep->state) {
+    case RPT_INIT:
+      ep->state = correct ? RPT_STEADY : RPT_TRANSIENT;
+      break;
+    case RPT_TRANSIENT:
+      ep->state = correct ? RPT_STEADY : RPT_NOPRED;
+      break;
+    case RPT_STEADY:
+      /* keep the stride over a single irregular access */
+      ep->state = correct ? RPT_STEADY : RPT_INIT;
+      break;
+    case RPT_NOPRED:
+      ep->state = correct ? RPT_TRANSIENT : RPT_NOPRED;
+      break;
+  }
+  if (!correct && ep->state != RPT_INIT)
+    ep->stride = stride;
+  ep->last = addr;
+
+  if (ep->state != RPT_STEADY || !ep->stride)
+    return;
+  for (i = 1; i <= cp->pf_degree; ++i) {
+    cache_prefetch(cp, addr + i * ep->stride);
+  }
+}
+
+/* stream buffers: a miss that no buffer holds restarts the least recently
+   used one on the pf_depth lines after it (Jouppi); the lines wait in the
+   buffer, not in the cache, and a later miss on one of them moves it in.
+   Only the timing is buffered, the data is still read at that miss so a
+   buffer never holds a stale copy */
+unsigned int stream_size(struct cache* cp) {
+  return cp->pf_streams * (sizeof(struct stream_buf)
+                           + cp->pf_depth * sizeof(struct stream_entry));
+}
+
+static void stream_fill(struct cache* cp, struct stream_buf* sb, struct stream_entry* ents) {
+  struct stream_entry* ep;
+  while (sb->count < cp->pf_depth) {
+    ep = ents + (sb->head + sb->count) % cp->pf_depth;
+    ep->addr = sb->next;
+    ep->ready = sim_num_cycle + cache_fetch_latency(cp, sb->next);
+    sb->next += cp->offset_mask + 1;
+    ++sb->count;
+    ++cp->pfIssueCounter;
+  }
+}
+
+int stream_miss(struct cache* cp, md_addr_t addr, unsigned int* wait) {
+  struct stream_buf* bufs = cp->pf_state;
+  struct stream_entry* ents = (struct stream_entry*)(bufs + cp->pf_streams);
+  struct stream_buf* sb;
+  struct stream_entry* ep;
+  unsigned int i, k, lru = 0;
+
+  for (i = 0; i < cp->pf_streams; ++i) {
+    sb = bufs + i;
+    for (k = 0; k < sb->count; ++k) {
+      ep = ents + i * cp->pf_depth + (sb->head + k) % cp->pf_depth;
+      if (ep->addr != addr)
+        continue;
+      /* the lines skipped over are dropped unused */
+      cp->pfUselessCounter += k;
+      ++cp->pfUsefulCounter;
+      *wait = 0;
+      if (ep->ready > sim_num_cycle) {
+        ++cp->pfLateCounter;
+        *wait = ep->ready - sim_num_cycle;
+      }
+      sb->head = (sb->head + k + 1) % cp->pf_depth;
+      sb->count -= k + 1;
+      sb->stamp = cp->accessCounter;
+      stream_fill(cp, sb, ents + i * cp->pf_depth);
+      return TRUE;
+    }
+    if (sb->stamp < bufs[lru].stamp)
+      lru = i;
+  }
+
+  sb = bufs + lru;
+  cp->pfUselessCounter += sb->count;
+  sb->next = addr + cp->offset_mask + 1;
+  sb->head = 0;
+  sb->count = 0;
+  sb->stamp = cp->accessCounter;
+  stream_fill(cp, sb, ents + lru * cp->pf_depth);
+  return FALSE;
+}
+
+/* the prefetches of the stream buffers have all arrived */
+static void stream_settle(struct cache* cp) {
+  struct stream_entry* ents = (struct stream_entry*)((struct stream_buf*)cp->pf_state
+                                                     + cp->pf_streams);
+  unsigned int i;
+  for (i = 0; i < cp->pf_streams * cp->pf_depth; ++i)
+    ents[i].ready = 0;
+}
+
+static struct prefetcher prefetchers[] = {
+  { "nextline", pf_no_size, nextline_access, NULL },
+  { "stride", stride_size, stride_access, NULL },
+  { "stream", stream_size, NULL, stream_miss },
+};
+
+struct prefetcher* pf_lookup(char* name) {
+  int i;
+  for (i = 0; i < N_ELT(prefetchers); ++i) {
+    if (!strcmp(prefetchers[i].name, name))
+      return &prefetchers[i];
+  }
+  return NULL;
+}
+
+unsigned int cache_flush(struct cache* cp) {
+  unsigned int i, way, line;
+  for (i = 0; i < cp->nsets; ++i) {
+    for (way = 0; way < cp->assoc; ++way) {
+      if (!(cp->dirty[i] & (1u << way)))
+        continue;
+      if (cp->next && cp->next->incl == INCL_EXCLUSIVE) {
+        /* the line stays here, so do not hand it to an exclusive level */
+        line = LINE_IDX(cp, i, way);
+        cache_write_mem(cp->data + line * cp->line_words,
+                        (cp->tags[line] << cp->tag_shift) | (i << cp->line_shift),
+                        cp->line_words);
+        cp->dirty[i] &= ~(1u << way);
+      } else {
+        cache_write_back(cp, i, way);
+      }
+    }
+  }
+  for (i = 0; i < cp->nvictim; ++i) {
+    if (!(cp->vc_valid & cp->vc_dirty & (1u << i)))
+      continue;
+    if (cp->next && cp->next->incl != INCL_EXCLUSIVE)
+      cache_put_line(cp->next, cp->vc_addr[i], cp->vc_data + i * cp->line_words,
+                     cp->line_words, TRUE);
+    else
+      cache_write_mem(cp->vc_data + i * cp->line_words, cp->vc_addr[i],
+                      cp->line_words);
+    cp->vc_dirty &= ~(1u << i);
+  }
+  return 0;
+}
+
+void cache_log(struct cache* cp) {
+  printf("[%s] Total number of memory access: %d\n", cp->name, cp->accessCounter);
+  printf("[%s] Total number of cache hits: %d\n", cp->name, cp->hitCounter);
+  printf("[%s] Total number of cache misses: %d\n", cp->name, cp->missCounter);
+  printf("[%s] Total number of cache line replacements: %d\n", cp->name, cp->replaceCounter);
+  printf("[%s] Total number of cache line write backs: %d\n", cp->name, cp->wbCounter);
+  if (cp->pf) {
+    printf("[%s] Total number of prefetches: %d\n", cp->name, cp->pfIssueCounter);
+    printf("[%s] Total number of useful prefetches: %d\n", cp->name, cp->pfUsefulCounter);
+    printf("[%s] Total number of late prefetches: %d\n", cp->name, cp->pfLateCounter);
+    printf("[%s] Total number of useless prefetches: %d\n", cp->name, cp->pfUselessCounter);
+  }
+  if (cp->nmshr) {
+    printf("[%s] Total number of secondary misses merged: %d\n", cp->name, cp->mshrMergeCounter);
+    printf("[%s] Total number of misses with all MSHRs busy: %d\n", cp->name, cp->mshrFullCounter);
+    printf("[%s] Total number of cycles waiting for an MSHR: %d\n", cp->name, cp->mshrStallCounter);
+  }
+  if (cp->nvictim)
+    printf("[%s] Total number of victim cache hits: %d\n", cp->name, cp->victimHitCounter);
+  if (!cp->walloc || cp->wthrough)
+    printf("[%s] Total number of stores written through or around: %d\n", cp->name, cp->wtCounter);
+  if (cp->nwbuf) {
+    printf("[%s] Total number of writes coalesced in the write buffer: %d\n", cp->name, cp->wbufMergeCounter);
+    printf("[%s] Total number of writes finding the write buffer full: %d\n", cp->name, cp->wbufFullCounter);
+    printf("[%s] Total number of cycles waiting for the write buffer: %d\n", cp->name, cp->wbufStallCounter);
+  }
+  if (cp->mrc)
+    cache_mrc_log(cp);
+}
+
+/* end a warm-up: every access in flight completes, so the clock can start
+   again from 0, and the counters are cleared; the lines and the replacement
+   and prefetcher state stay */
+static void cache_settle(struct cache* cp) {
+  unsigned int i;
+  memset(cp->ready, 0, cp->nsets * cp->assoc * sizeof(unsigned int));
+  for (i = 0; i < cp->nmshr; ++i)
+    cp->mshr[i] = 0;
+  for (i = 0; i < cp->nwbuf; ++i)
+    cp->wbuf[i].drain = 0;
+  cp->done = cp->wbuf_tail = cp->wstall = 0;
+  if (cp->pf && cp->pf->miss == stream_miss)
+    stream_settle(cp);
+  /* the counters are the last fields of struct cache */
+  memset(&cp->accessCounter, 0,
+         (char*)(&cp->victimHitCounter + 1) - (char*)&cp->accessCounter);
+  if (cp->mrc) {
+    memset(cp->mrc->hist, 0, cp->mrc->nconf * (cp->mrc->depth + 1) * sizeof(counter_t));
+    cp->mrc->refs = 0;
+  }
+}
+
+void cache_end_warmup() {
+  cache_settle(&il1);
+  cache_settle(&dl1);
+  if (l2_size)
+    cache_settle(&l2);
+  sim_num_cycle = 0;
+}
+
+/* write or read back one block of cache state, a short file is fatal */
+static void cache_io(FILE* fp, void* p, size_t n, int save) {
+  if (!n)
+    return;
+  if (save ? fwrite(p, n, 1, fp) != 1 : fread(p, n, 1, fp) != 1)
+    fatal(save ? "cannot write the cache state" : "cache state is truncated");
+}
+
+/* write or read back the lines, the replacement, prefetcher, MSHR, write
+   buffer and victim state, and the counters of a cache; a restore checks
+   that the cache is built the same way first */
+static void cache_state(struct cache* cp, FILE* fp, int save) {
+  unsigned int nlines = cp->nsets * cp->assoc;
+  unsigned int geom[8], saved[8];
+
+  geom[0] = cp->nsets;
+  geom[1] = cp->assoc;
+  geom[2] = cp->line_words;
+  geom[3] = cp->repl_words;
+  geom[4] = cp->nmshr;
+  geom[5] = cp->nwbuf;
+  geom[6] = cp->nvictim;
+  geom[7] = cp->pf ? cp->pf->size(cp) + 1 : 0;
+  memcpy(saved, geom, sizeof(geom));
+  cache_io(fp, saved, sizeof(saved), save);
+  if (memcmp(saved, geom, sizeof(geom)))
+    fatal("the saved %s is not configured like this one", cp->name);
+
+  cache_io(fp, cp->tags, nlines * sizeof(unsigned int), save);
+  cache_io(fp, cp->data, nlines * cp->line_words * sizeof(word_t), save);
+  cache_io(fp, cp->ready, nlines * sizeof(unsigned int), save);
+  cache_io(fp, cp->valid, cp->nsets * sizeof(unsigned int), save);
+  cache_io(fp, cp->dirty, cp->nsets * sizeof(unsigned int), save);
+  cache_io(fp, cp->pref, cp->nsets * sizeof(unsigned int), save);
+  cache_io(fp, cp->repl, cp->nsets * cp->repl_words * sizeof(unsigned int), save);
+  if (cp->pf)
+    cache_io(fp, cp->pf_state, geom[7], save);
+  cache_io(fp, cp->mshr, cp->nmshr * sizeof(unsigned int), save);
+  cache_io(fp, cp->wbuf, cp->nwbuf * sizeof(struct wbuf_entry), save);
+  if (cp->nvictim) {
+    cache_io(fp, cp->vc_addr, cp->nvictim * sizeof(md_addr_t), save);
+    cache_io(fp, cp->vc_stamp, cp->nvictim * sizeof(unsigned int), save);
+    cache_io(fp, cp->vc_data, cp->nvictim * cp->line_words * sizeof(word_t), save);
+  }
+  cache_io(fp, &cp->fills, sizeof(cp->fills), save);
+  cache_io(fp, &cp->done, sizeof(cp->done), save);
+  cache_io(fp, &cp->wbuf_tail, sizeof(cp->wbuf_tail), save);
+  cache_io(fp, &cp->wstall, sizeof(cp->wstall), save);
+  cache_io(fp, &cp->vc_valid, sizeof(cp->vc_valid), save);
+  cache_io(fp, &cp->vc_dirty, sizeof(cp->vc_dirty), save);
+  /* the counters are the last fields of struct cache */
+  cache_io(fp, &cp->accessCounter,
+           (char*)(&cp->victimHitCounter + 1) - (char*)&cp->accessCounter, save);
+}
+
+void cache_save(FILE* fp) {
+  cache_state(&il1, fp, TRUE);
+  cache_state(&dl1, fp, TRUE);
+  if (l2_size)
+    cache_state(&l2, fp, TRUE);
+}
+
+void cache_restore(FILE* fp) {
+  cache_state(&il1, fp, FALSE);
+  cache_state(&dl1, fp, FALSE);
+  if (l2_size)
+    cache_state(&l2, fp, FALSE);
+}
+
+void cache_flush_all() {
+  cache_flush(&il1);
+  cache_flush(&dl1);
+  if (l2_size)
+    cache_flush(&l2);
+}
+
+void cache_log_all() {
+  printf("Total number of clock cycles: %d\n", sim_num_cycle);
+  cache_log(&il1);
+  cache_log(&dl1);
+  if (l2_size)
+    cache_log(&l2);
+}
@@ -0,0 +1,368 @@
+/* Cache hierarchy of sim-pipe, also driven by the trace replay tool */
+
+#ifndef PIPE_CACHE_H
+#define PIPE_CACHE_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+#include "memory.h"
+#include "options.h"
+
+/* cache part */
+
+#define CACHE_SIZE 1024     /* default L1 cache size is 1 KB */
+#define CACHE_ASSOC 4     /* default is a 4-way set-associative cache */
+#define CACHE_LINE 16     /* default cache line is 16 bytes */
+#define L2_SIZE 16384     /* default L2 cache size is 16 KB */
+#define L2_ASSOC 8     /* default L2 is 8-way set-associative */
+#define L2_LINE 32     /* default L2 cache line is 32 bytes */
+#define HIT_LATENCY 1     /* cache hit latency is 1 cycle */
+#define MISS_LATENCY 10     /* cache miss latency is 10 cycle */
+#define L2_LATENCY 4     /* L2 access adds 4 cycles */
+#define MEM_LATENCY (MISS_LATENCY - HIT_LATENCY)     /* memory access adds 9 cycles */
+#define ADDR_TAG(CP, ADDR) (((unsigned int) ADDR) >> (CP)->tag_shift)     /* get tag bits */
+#define ADDR_IDX(CP, ADDR) ((((unsigned int) ADDR) >> (CP)->line_shift) & (CP)->idx_mask)      /* get index bits */
+#define ADDR_OFFSET(CP, ADDR) (((unsigned int) ADDR) & (CP)->offset_mask)       /* get offset bits */
+#define ADDR_ALIGN(CP, ADDR) (((unsigned int) ADDR) & ~(CP)->offset_mask)      /* get line address */
+
+/* index of a (set, way) pair into the flat line arrays */
+#define LINE_IDX(CP, IDX, WAY) (((IDX) << (CP)->assoc_shift) + (WAY))
+
+/* max re-reference prediction value of SRRIP/BRRIP (2-bit counters) */
+#define RRPV_MAX 3
+/* BRRIP inserts one line in RRIP_THROTTLE with a long (not distant) interval */
+#define RRIP_THROTTLE 32
+
+/* default prefetcher parameters */
+#define PF_DEGREE 1     /* lines fetched ahead per trigger */
+#define PF_RPT 64     /* entries of the stride reference prediction table */
+#define PF_STREAMS 4     /* number of stream buffers */
+#define PF_DEPTH 4     /* lines held by each stream buffer */
+#define DL1_MSHR 0     /* default L1 data cache is blocking (no MSHRs) */
+#define WBUF_SIZE 0     /* default is no write buffer, writes to a lower level are synchronous */
+#define VICTIM_SIZE 0     /* default is no victim cache */
+#define VICTIM_LATENCY 1     /* a victim cache hit adds 1 cycle */
+#define MRC_SETS 1024     /* miss ratio curves cover 1 to 1024 sets */
+#define MRC_WAYS 32     /* and 1 to 32 ways */
+
+struct cache;
+
+/* LRU stack distance profile of the requests to a cache (Mattson et al.):
+   a stack of the last depth lines of each set, most recent first, for
+   every set count 1, 2, 4 .. max, so one pass gives the LRU misses of
+   every size and associativity up to depth ways */
+struct mrc_prof {
+  unsigned int nconf;               /* set counts profiled */
+  unsigned int depth;               /* ways profiled, depth of each stack */
+  md_addr_t* stack;                 /* depth line addresses of each set, the sets of
+                                       all set counts one after the other */
+  unsigned int* fill;               /* entries held by each stack */
+  counter_t* hist;                  /* depth + 1 counts of each set count, of
+                                       requests hitting at each stack distance,
+                                       the last one deeper or never seen */
+  counter_t refs;                   /* requests profiled */
+};
+
+/* how the lines of a cache relate to those of the caches above it */
+enum cache_incl {
+  INCL_NINE = 0,      /* neither inclusive nor exclusive */
+  INCL_INCLUSIVE,     /* holds every line above, evicting back-invalidates */
+  INCL_EXCLUSIVE      /* holds only lines evicted from above */
+};
+
+/* replacement policy, all per-set metadata lives in repl_words words of
+   bit-packed state at cp->repl + idx * cp->repl_words; hit and fill may
+   be NULL when the policy does not care */
+struct repl_policy {
+  char* name;                                           /* option name */
+  unsigned int (*words)(struct cache*);                 /* state words of a set */
+  void (*init)(struct cache*, unsigned int*);           /* reset a set */
+  void (*hit)(struct cache*, unsigned int*, unsigned int);    /* way was hit */
+  void (*fill)(struct cache*, unsigned int*, unsigned int);   /* way was filled */
+  unsigned int (*victim)(struct cache*, unsigned int*);       /* way to replace */
+};
+
+/* hardware prefetcher, it watches the demand accesses of one cache and
+   brings lines in with cache_prefetch(); access and miss may be NULL, miss
+   serves a demand miss out of a buffer of the prefetcher */
+struct prefetcher {
+  char* name;                                           /* option name */
+  unsigned int (*size)(struct cache*);                  /* bytes of state */
+  void (*access)(struct cache*, md_addr_t, md_addr_t, int);   /* demand access at
+                                     (addr, pc), triggered if it missed or first
+                                     hit a prefetched line */
+  int (*miss)(struct cache*, md_addr_t, unsigned int*);       /* demand miss of a
+                                     line, TRUE and the cycles left if buffered */
+};
+
+/* reference prediction table entry of the stride prefetcher */
+enum rpt_state { RPT_INIT = 0, RPT_TRANSIENT, RPT_STEADY, RPT_NOPRED };
+struct rpt_entry {
+  md_addr_t pc;                     /* pc of the load/store */
+  md_addr_t last;                   /* address it last accessed */
+  int stride;                       /* distance of its last two accesses */
+  enum rpt_state state;             /* confidence of the stride */
+};
+
+/* stream buffer, a FIFO of the next pf_depth lines after a miss */
+struct stream_buf {
+  md_addr_t next;                   /* line to prefetch next */
+  unsigned int head;                /* oldest entry */
+  unsigned int count;               /* entries held */
+  unsigned int stamp;               /* access count of the last use */
+};
+
+struct stream_entry {
+  md_addr_t addr;                   /* line address */
+  unsigned int ready;               /* cycle its data arrives */
+};
+
+/* write buffer entry, a pending write of one line to the next level;
+   writes to the same line coalesce while it waits */
+struct wbuf_entry {
+  md_addr_t addr;                   /* line address */
+  unsigned int drain;               /* cycle the write leaves the buffer */
+};
+
+/* the cache is kept as a structure of arrays, all allocated once by
+   cache_init(), so a lookup only scans the tags of one set and a miss
+   never touches the heap */
+struct cache {
+  char* name;                       /* name of the level */
+  unsigned int nsets;               /* number of sets */
+  unsigned int assoc;               /* number of ways of each set */
+  unsigned int line_words;          /* number of words of each line */
+  unsigned int line_shift;          /* log2 of the line size */
+  unsigned int assoc_shift;         /* log2 of the associativity */
+  unsigned int tag_shift;           /* log2 of the line size times the set number */
+  unsigned int offset_mask;         /* mask of the offset bits */
+  unsigned int idx_mask;            /* mask of the index bits (after shift) */
+  unsigned int full_mask;           /* valid mask of a full set */
+  unsigned int* tags;               /* tag bits of each line */
+  word_t* data;                     /* line_words words of each line */
+  unsigned int* valid;              /* valid bit of each way, one mask per set */
+  unsigned int* dirty;              /* dirty bit of each way, one mask per set */
+  struct repl_policy* policy;       /* replacement policy */
+  unsigned int* repl;               /* replacement state of each set */
+  unsigned int repl_words;          /* words of replacement state per set */
+  unsigned int rank_bits;           /* width of a per-way LRU rank field */
+  unsigned int fills;               /* lines filled, throttles BRRIP */
+  unsigned int hit_lat;             /* cycles of an access to this level */
+  unsigned int mem_lat;             /* cycles added by memory if no next level */
+  struct cache* next;               /* next level, NULL for memory */
+  struct cache* above[2];           /* levels backed by this one */
+  unsigned int nabove;              /* number of levels above */
+  enum cache_incl incl;             /* inclusion of the levels above */
+  struct prefetcher* pf;            /* hardware prefetcher, NULL for none */
+  unsigned int pf_degree;           /* lines fetched ahead per trigger */
+  unsigned int pf_rpt;              /* entries of the stride table */
+  unsigned int pf_streams;          /* number of stream buffers */
+  unsigned int pf_depth;            /* lines of each stream buffer */
+  void* pf_state;                   /* private state of the prefetcher */
+  unsigned int* pref;               /* prefetched, not yet used bit of each way, one mask per set */
+  unsigned int* ready;              /* cycle the data of each line arrives */
+  unsigned int nmshr;               /* number of MSHRs, 0 for a blocking cache */
+  unsigned int* mshr;               /* cycle each MSHR frees */
+  unsigned int done;                /* cycle the data of the last access arrives */
+  unsigned int walloc;              /* if a store miss allocates a line */
+  unsigned int wthrough;            /* if stores are written through to the next level */
+  unsigned int nwbuf;               /* entries of the write buffer, 0 for none */
+  struct wbuf_entry* wbuf;          /* write buffer to the next level */
+  unsigned int wbuf_tail;           /* cycle the last queued write drains */
+  unsigned int wstall;              /* cycles victims of this access waited to be written */
+  unsigned int nvictim;             /* lines of the victim cache, 0 for none */
+  unsigned int vc_full;             /* valid mask of a full victim cache */
+  unsigned int vc_valid;            /* valid bit of each victim line */
+  unsigned int vc_dirty;            /* dirty bit of each victim line */
+  md_addr_t* vc_addr;               /* line address of each victim line */
+  unsigned int* vc_stamp;           /* access count each victim line came in */
+  word_t* vc_data;                  /* line_words words of each victim line */
+  word_t* vc_tmp;                   /* one line, for a swap */
+  struct mrc_prof* mrc;             /* stack distance profile, NULL for none */
+  unsigned int isEnabled;           /* if the cache is enabled */
+  unsigned int accessCounter;       /* times of cache access */
+  unsigned int hitCounter;          /* times of cache hit */
+  unsigned int missCounter;         /* times of cache miss */
+  unsigned int replaceCounter;      /* times of cache line replacement */
+  unsigned int wbCounter;           /* times of write back */
+  unsigned int pfIssueCounter;      /* times of prefetch */
+  unsigned int pfUsefulCounter;     /* prefetched lines used by a demand access */
+  unsigned int pfLateCounter;       /* used before their data arrived */
+  unsigned int pfUselessCounter;    /* evicted or dropped without being used */
+  unsigned int mshrMergeCounter;    /* times of secondary miss merged into an MSHR */
+  unsigned int mshrFullCounter;     /* times of miss finding every MSHR busy */
+  unsigned int mshrStallCounter;    /* cycles waited for a free MSHR */
+  unsigned int wtCounter;           /* times of store written through or around */
+  unsigned int wbufMergeCounter;    /* times of write coalesced in the write buffer */
+  unsigned int wbufFullCounter;     /* times of write finding the write buffer full */
+  unsigned int wbufStallCounter;    /* cycles waited for the write buffer */
+  unsigned int victimHitCounter;    /* times of miss caught by the victim cache */
+};
+
+/* compute the geometry of a cache of given size, associativity and line
+   size (all in bytes or ways, powers of two) and allocate its arrays */
+void cache_create(struct cache*, char*, unsigned int, unsigned int, unsigned int,
+                  struct repl_policy*);
+
+/* back an upper level cache by a lower one */
+void cache_link(struct cache*, struct cache*);
+
+/* find a replacement policy by its option name, NULL if unknown */
+struct repl_policy* repl_lookup(char*);
+
+/* attach a prefetcher to a cache, its pf_* parameters must be set */
+void cache_set_prefetcher(struct cache*, struct prefetcher*);
+
+/* find a prefetcher by its option name, NULL if unknown */
+struct prefetcher* pf_lookup(char*);
+
+/* give a cache MSHRs, so a miss no longer blocks the requester */
+void cache_set_mshr(struct cache*, unsigned int);
+
+/* the MSHR that frees first, free if its cycle has passed */
+unsigned int cache_mshr_next(struct cache*);
+
+/* give a cache a write buffer of given entries to the next level */
+void cache_set_wbuf(struct cache*, unsigned int);
+
+/* queue a write of the line holding given address to the next level,
+   return the cycles the writer stalls */
+unsigned int cache_wbuf_put(struct cache*, md_addr_t);
+
+/* give a cache a fully-associative victim cache of given lines */
+void cache_set_victim(struct cache*, unsigned int);
+
+/* look up the victim line holding given line address, -1 on miss */
+int cache_victim_probe(struct cache*, md_addr_t);
+
+/* move the line of a way into the victim cache, pushing out the oldest */
+void cache_victim_put(struct cache*, unsigned int, unsigned int);
+
+/* move a victim line back into given set, return the way it got */
+unsigned int cache_victim_swap(struct cache*, unsigned int, unsigned int, md_addr_t);
+
+/* profile the LRU stack distances of the requests to a cache, for set
+   counts up to the first argument and associativities up to the second */
+void cache_set_mrc(struct cache*, unsigned int, unsigned int);
+
+/* push the line of a request on the stacks of every set count */
+void cache_mrc_access(struct cache*, md_addr_t);
+
+/* print the LRU misses of every profiled size and associativity */
+void cache_mrc_log(struct cache*);
+
+/* register the options of the cache hierarchy */
+void cache_reg_options(struct opt_odb_t*);
+
+/* check the options of the cache hierarchy */
+void cache_check_options();
+
+/* build the L1 instruction/data caches and the L2 behind them, in front
+   of given memory */
+void cache_init(struct mem_t*);
+
+/* function pointer to cache read/write function */
+typedef void (*cache_func)(struct cache*, unsigned int, unsigned int, word_t*);
+
+/* cache read function */
+void cache_do_read(struct cache*, unsigned int, unsigned int, word_t*);
+
+/* cache write function */
+void cache_do_write(struct cache*, unsigned int, unsigned int, word_t*);
+
+/* cache write function of a write-through cache, the line stays clean */
+void cache_do_write_through(struct cache*, unsigned int, unsigned int, word_t*);
+
+/* access the cache (read/write based on the function pointer) on behalf
+   of the instruction at pc, return the cycles the requester is blocked;
+   with MSHRs the data may only arrive later, at cp->done */
+unsigned int cache_access(struct cache*, md_addr_t, md_addr_t, word_t*, cache_func);
+
+/* read data from given address into destination */
+unsigned int cache_read(struct cache*, md_addr_t, md_addr_t, word_t*);
+
+/* write data into given address */ 
+unsigned int cache_write(struct cache*, md_addr_t, md_addr_t, word_t*);
+
+/* look up the way holding a tag in given set, -1 on miss */
+int cache_probe(struct cache*, unsigned int, unsigned int);
+
+/* read words of the line holding given address from a lower level, return
+   the cycles spent and whether the words are dirty */
+unsigned int cache_get_line(struct cache*, md_addr_t, word_t*, unsigned int, int*);
+
+/* write words of a line evicted from an upper level into a lower level */
+void cache_put_line(struct cache*, md_addr_t, word_t*, unsigned int, int);
+
+/* claim a way for the line holding given address, no data is moved */
+void cache_install(struct cache*, unsigned int, unsigned int, md_addr_t);
+
+/* load the line holding given address into a way of the set from the next
+   level, return the cycles spent */
+unsigned int cache_fill_line(struct cache*, unsigned int, unsigned int, md_addr_t);
+
+/* write a dirty line back to the next level */
+void cache_write_back(struct cache*, unsigned int, unsigned int);
+
+/* write the words of a line straight to memory */
+void cache_write_mem(word_t*, md_addr_t, unsigned int);
+
+/* write a word to the level below a cache, for a store written through or
+   around it */
+void cache_write_next(struct cache*, md_addr_t, word_t*);
+
+/* cycles the next level (or memory) would take to deliver the line holding
+   given address, nothing is changed */
+unsigned int cache_fetch_latency(struct cache*, md_addr_t);
+
+/* bring the line holding given address in ahead of a demand access */
+void cache_prefetch(struct cache*, md_addr_t);
+
+/* send a line leaving the cache to the next level: dirty lines are
+   written back, clean ones only go to an exclusive level */
+void cache_write_victim(struct cache*, md_addr_t, word_t*, int);
+
+/* move the line of a way out of the cache */
+void cache_evict(struct cache*, unsigned int, unsigned int);
+
+/* drop the copies above of a line, merging their dirty data into it */
+void cache_back_invalidate(struct cache*, unsigned int, unsigned int);
+
+/* pick the way for a new line in given set, evicting a victim if full */
+unsigned int add_cache_line(struct cache*, unsigned int);
+
+/* write all dirty line back */
+unsigned int cache_flush(struct cache*);
+
+/* print cache statistics */
+void cache_log(struct cache*);
+
+/* write every level back to memory, upper levels first */
+void cache_flush_all();
+
+/* print the statistics of every level */
+void cache_log_all();
+
+/* complete every access in flight, restart the clock and clear the
+   counters of every level, keeping the lines warm */
+void cache_end_warmup();
+
+/* write the state of every level to an open checkpoint, the miss ratio
+   profiles are left out */
+void cache_save(FILE*);
+
+/* read the state of every level back from a checkpoint, the levels must
+   be configured as they were when it was taken */
+void cache_restore(FILE*);
+
+/* L1 instruction/data caches and the unified L2 */
+extern struct cache il1;
+extern struct cache dl1;
+extern struct cache l2;
+
+/* clock cycle counter, kept by the user of the caches */
+extern unsigned int sim_num_cycle;
+
+#endif /* PIPE_CACHE_H */
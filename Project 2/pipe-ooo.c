@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The out-of-order engine of sim-pipe.  It models timing only: sim-pipe
+   executes each instruction in program order as it is fetched, through
+   the caches, and hands it over with its operands and latencies.  The
+   engine then works out, in the order of the run, when the instruction is
+   dispatched into the ROB, the issue queue and the load/store queue, when
+   its operands are ready through the rename table, when it issues and
+   when it commits.  Fetch and dispatch are in order, issue is out of
+   order, commit in order again. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "options.h"
+#include "pipe-ooo.h"
+
+/* engine options */
+static int ooo_flag;
+static int ooo_width;
+static int ooo_rob;
+static int ooo_iq;
+static int ooo_lsq;
+
+/* cycles from issue to the result of each unit class, as sim-outorder */
+static unsigned int fu_lat[NUM_FU_CLASSES] = {
+  /* FUClass_NA */ 1, /* IntALU */ 1, /* IntMULT */ 3, /* IntDIV */ 20,
+  /* FloatADD */ 2, /* FloatCMP */ 2, /* FloatCVT */ 2, /* FloatMULT */ 4,
+  /* FloatDIV */ 12, /* FloatSQRT */ 24, /* RdPort */ 1, /* WrPort */ 1
+};
+
+struct ooo ooo;
+
+/* register the options of the engine */
+void
+ooo_reg_options(struct opt_odb_t *odb)
+{
+  opt_reg_flag(odb, "-ooo",
+	       "time the run with the out-of-order engine instead of the "
+	       "pipeline",
+	       &ooo_flag, /* default */FALSE,
+	       /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ooo:width",
+	      "instructions fetched, dispatched, issued and committed in a "
+	      "cycle",
+	      &ooo_width, /* default */OOO_WIDTH,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ooo:rob", "reorder buffer entries",
+	      &ooo_rob, /* default */OOO_ROB,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ooo:iq", "issue queue entries",
+	      &ooo_iq, /* default */OOO_IQ,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ooo:lsq", "load/store queue entries",
+	      &ooo_lsq, /* default */OOO_LSQ,
+	      /* print */TRUE, /* format */NULL);
+}
+
+/* check the options of the engine */
+void
+ooo_check_options()
+{
+  ooo.enabled = ooo_flag;
+  if (!ooo_flag)
+    return;
+  if (ooo_width < 1 || ooo_width > 16)
+    fatal("out-of-order width must be between 1 and 16");
+  if (ooo_rob < 1 || ooo_iq < 1 || ooo_lsq < 1)
+    fatal("the ROB, the issue queue and the load/store queue need an entry "
+          "at least");
+  if (ooo_rob > OOO_RING / 4)
+    fatal("the ROB holds at most %d entries", OOO_RING / 4);
+}
+
+/* build the engine, empty */
+void
+ooo_init()
+{
+  struct ooo* e = &ooo;
+
+  if (!e->enabled)
+    return;
+  memset(e, 0, sizeof(*e));
+  e->enabled = TRUE;
+  e->width = ooo_width;
+  e->rob_size = ooo_rob;
+  e->iq_size = ooo_iq;
+  e->lsq_size = ooo_lsq;
+  e->rob = (tick_t*)calloc(e->rob_size, sizeof(tick_t));
+  e->iq = (tick_t*)calloc(e->iq_size, sizeof(tick_t));
+  e->lsq = (struct lsq_entry*)calloc(e->lsq_size, sizeof(struct lsq_entry));
+  e->slot_cycle = (tick_t*)calloc(OOO_RING, sizeof(tick_t));
+  e->slot_num = (unsigned int*)calloc(OOO_RING, sizeof(unsigned int));
+  if (!e->rob || !e->iq || !e->lsq || !e->slot_cycle || !e->slot_num)
+    fatal("out of virtual memory");
+}
+
+/* free the issue queue entries of the instructions issued before cycle d */
+static void iq_drain(struct ooo* e, tick_t d) {
+  unsigned int i, n = 0;
+  for (i = 0; i < e->iq_num; ++i) {
+    if (e->iq[i] >= d)
+      e->iq[n++] = e->iq[i];
+  }
+  e->iq_num = n;
+}
+
+/* the first issue cycle from c with a slot left, taken; the ring only
+   holds cycles within reach of the instructions in the ROB */
+static tick_t issue_slot(struct ooo* e, tick_t c) {
+  unsigned int k;
+  for (;; ++c) {
+    k = (unsigned int)(c & (OOO_RING - 1));
+    if (e->slot_cycle[k] != c) {
+      e->slot_cycle[k] = c;
+      e->slot_num[k] = 0;
+    }
+    if (e->slot_num[k] < e->width) {
+      ++e->slot_num[k];
+      return c;
+    }
+  }
+}
+
+/* work out when the next instruction of the run issues and commits */
+void ooo_insn(struct ooo_inst* in) {
+  struct ooo* e = &ooo;
+  struct lsq_entry* q;
+  tick_t d, r, i, c, cm, h, t;
+  unsigned int k, n, lat = in->lat ? in->lat : fu_lat[in->fu], miss = in->miss;
+  int mem = (in->flags & F_MEM) != 0;
+
+  /* fetch: width instructions a cycle, a group ends at a control
+     instruction, and an il1 miss holds the group back */
+  if (e->fetched == e->width) {
+    ++e->fetch;
+    e->fetched = 0;
+  }
+  if (in->fetch_stall) {
+    e->fetch += in->fetch_stall;
+    e->fetched = 0;
+  }
+  ++e->fetched;
+  if (in->flags & F_CTRL)
+    e->fetched = e->width;
+
+  /* dispatch: in order, width a cycle, once the ROB, the load/store queue
+     and the issue queue have an entry; a system call waits for the ROB to
+     drain */
+  d = e->fetch + OOO_DEPTH;
+  if (d < e->dispatch)
+    d = e->dispatch;
+  if (d == e->dispatch && e->dispatched == e->width)
+    ++d;
+  if (in->serial && d <= e->commit)
+    d = e->commit + 1;
+  if (e->seq >= e->rob_size) {
+    t = e->rob[e->seq % e->rob_size] + 1;
+    if (t > d) {
+      e->robFullCounter += t - d;
+      d = t;
+    }
+  }
+  if (mem && e->lsq_seq >= e->lsq_size) {
+    t = e->lsq[e->lsq_seq % e->lsq_size].commit + 1;
+    if (t > d) {
+      e->lsqFullCounter += t - d;
+      d = t;
+    }
+  }
+  iq_drain(e, d);
+  while (e->iq_num == e->iq_size) {
+    t = e->iq[0];
+    for (k = 1; k < e->iq_num; ++k) {
+      if (e->iq[k] < t)
+        t = e->iq[k];
+    }
+    e->iqFullCounter += t + 1 - d;
+    d = t + 1;
+    iq_drain(e, d);
+  }
+  if (d != e->dispatch) {
+    e->dispatch = d;
+    e->dispatched = 0;
+  }
+  ++e->dispatched;
+
+  /* operands: the rename table has the cycle each register is written by
+     its last writer ahead, so only true dependences wait */
+  r = d + 1;
+  for (k = 0; k < 3; ++k) {
+    if (in->in[k] > 0 && e->ready[in->in[k]] > r)
+      r = e->ready[in->in[k]];
+  }
+  /* a load takes the data of the youngest store ahead to the same word
+     while that store is still in the queue; addresses are known at
+     dispatch, so a load never waits for an unrelated store */
+  if ((in->flags & F_LOAD) && e->lsq_seq) {
+    for (n = 1; n <= e->lsq_size && n <= e->lsq_seq; ++n) {
+      q = &e->lsq[(e->lsq_seq - n) % e->lsq_size];
+      if (q->store && q->addr == in->addr && q->commit > d) {
+        if (q->data > r)
+          r = q->data;
+        lat = 1;
+        miss = 0;
+        ++e->forwardCounter;
+        break;
+      }
+    }
+  }
+
+  /* issue out of order, width a cycle, and leave the issue queue */
+  i = issue_slot(e, r);
+  e->iq[e->iq_num++] = i;
+  c = i + lat;
+  for (k = 0; k < 2; ++k) {
+    if (in->out[k] > 0)
+      e->ready[in->out[k]] = c;
+  }
+  /* fetch restarts at the right PC once a mispredicted instruction
+     resolves */
+  if (in->mispred && c + 1 > e->fetch) {
+    e->fetch = c + 1;
+    e->fetched = 0;
+  }
+
+  /* commit in order, width a cycle */
+  cm = c + 1;
+  if (cm < e->commit)
+    cm = e->commit;
+  if (cm == e->commit && e->committed == e->width)
+    ++cm;
+  if (miss) {
+    /* when the load would have committed with a dl1 hit */
+    h = c - miss + 1;
+    if (h < e->commit)
+      h = e->commit;
+    if (cm > h)
+      e->exposedCounter += cm - h;
+    e->missCounter += miss;
+  }
+  if (cm != e->commit) {
+    e->commit = cm;
+    e->committed = 0;
+  }
+  ++e->committed;
+  if (in->serial && cm + 1 > e->fetch) {
+    e->fetch = cm + 1;
+    e->fetched = 0;
+  }
+
+  e->rob[e->seq % e->rob_size] = cm;
+  ++e->seq;
+  if (mem) {
+    q = &e->lsq[e->lsq_seq % e->lsq_size];
+    q->addr = in->addr;
+    q->store = (in->flags & F_STORE) != 0;
+    q->data = i;
+    q->commit = cm;
+    ++e->lsq_seq;
+  }
+  ++e->insnCounter;
+}
+
+/* print engine statistics */
+void ooo_log() {
+  struct ooo* e = &ooo;
+  printf("[ooo] Total number of instructions committed: %d\n", e->insnCounter);
+  printf("[ooo] Total number of cycles dispatch waited for the ROB: %d\n", e->robFullCounter);
+  printf("[ooo] Total number of cycles dispatch waited for the issue queue: %d\n", e->iqFullCounter);
+  printf("[ooo] Total number of cycles dispatch waited for the load/store queue: %d\n", e->lsqFullCounter);
+  printf("[ooo] Total number of loads forwarded from a store: %d\n", e->forwardCounter);
+  printf("[ooo] Total number of load miss cycles: %d\n", e->missCounter);
+  printf("[ooo] Total number of load miss cycles exposed at commit: %d\n", e->exposedCounter);
+  if (e->missCounter)
+    printf("[ooo] Load miss cycles hidden: %.2f%%\n",
+           100.0 * (e->missCounter - e->exposedCounter) / e->missCounter);
+  if (e->commit)
+    printf("[ooo] IPC: %.3f\n", (double)e->insnCounter / e->commit);
+}
@@ -0,0 +1,90 @@
+/* Out-of-order timing engine of sim-pipe */
+
+#ifndef PIPE_OOO_H
+#define PIPE_OOO_H
+
+#include <stdio.h>
+
+#include "host.h"
+#include "machine.h"
+#include "options.h"
+
+#define OOO_WIDTH 4     /* default instructions fetched, dispatched, issued and committed in a cycle */
+#define OOO_ROB 64     /* default reorder buffer entries */
+#define OOO_IQ 32     /* default issue queue entries */
+#define OOO_LSQ 32     /* default load/store queue entries */
+#define OOO_DEPTH 2     /* cycles from fetch to dispatch: decode and rename */
+#define OOO_NUM_REGS 72     /* rename table entries, numbered as the operands of machine.def */
+#define OOO_RING 16384     /* cycles ahead the issue slots are kept for, a power of two */
+
+/* an instruction handed to the engine, executed already in program order */
+struct ooo_inst {
+  int in[3];                        /* registers read, negative for none */
+  int out[2];                       /* registers written, negative for none */
+  enum md_fu_class fu;              /* functional unit class */
+  unsigned int flags;               /* F_* flags of machine.def */
+  md_addr_t addr;                   /* word address of a load or store */
+  unsigned int lat;                 /* cycles from issue to the result, 0 for the default of the unit */
+  unsigned int miss;                /* cycles of lat past a dl1 hit, for a load */
+  unsigned int fetch_stall;         /* cycles its fetch waited on il1 past a hit */
+  int mispred;                      /* fetch went on at a wrong PC after it */
+  int serial;                       /* a system call, it runs alone */
+};
+
+/* load/store queue entry */
+struct lsq_entry {
+  md_addr_t addr;                   /* word address */
+  int store;                        /* TRUE for a store */
+  tick_t data;                      /* cycle a store has its address and data */
+  tick_t commit;                    /* cycle it leaves the queue */
+};
+
+struct ooo {
+  int enabled;                      /* if the engine replaces the pipeline */
+  unsigned int width;               /* instructions fetched, dispatched, issued and committed in a cycle */
+  unsigned int rob_size;            /* reorder buffer entries */
+  unsigned int iq_size;             /* issue queue entries */
+  unsigned int lsq_size;            /* load/store queue entries */
+  tick_t fetch;                     /* cycle of the current fetch group */
+  unsigned int fetched;             /* instructions fetched in it */
+  tick_t dispatch;                  /* cycle of the last dispatch */
+  unsigned int dispatched;          /* instructions dispatched in it */
+  tick_t commit;                    /* cycle of the last commit */
+  unsigned int committed;           /* instructions committed in it */
+  tick_t ready[OOO_NUM_REGS];       /* rename table: cycle the last writer of each register has its result */
+  counter_t seq;                    /* instructions so far, the next takes ROB entry seq % rob_size */
+  tick_t* rob;                      /* commit cycle of each ROB entry */
+  tick_t* iq;                       /* issue cycle of each instruction in the issue queue */
+  unsigned int iq_num;              /* instructions in the issue queue */
+  counter_t lsq_seq;                /* loads and stores so far */
+  struct lsq_entry* lsq;            /* lsq_size entries, circular */
+  tick_t* slot_cycle;               /* cycle of each issue slot of the ring */
+  unsigned int* slot_num;           /* instructions issued in it */
+  unsigned int insnCounter;         /* times of instruction committed */
+  unsigned int robFullCounter;      /* cycles dispatch waited for a ROB entry */
+  unsigned int iqFullCounter;       /* cycles dispatch waited for an issue queue entry */
+  unsigned int lsqFullCounter;      /* cycles dispatch waited for a load/store queue entry */
+  unsigned int forwardCounter;      /* loads that took their data from a store in the queue */
+  unsigned int missCounter;         /* cycles of load latency past a dl1 hit */
+  unsigned int exposedCounter;      /* of those, cycles the commit of the load was held back */
+};
+
+/* register the options of the engine */
+void ooo_reg_options(struct opt_odb_t*);
+
+/* check the options of the engine */
+void ooo_check_options();
+
+/* build the engine, empty */
+void ooo_init();
+
+/* work out when the next instruction of the run issues and commits */
+void ooo_insn(struct ooo_inst*);
+
+/* print engine statistics */
+void ooo_log();
+
+/* the out-of-order engine */
+extern struct ooo ooo;
+
+#endif /* PIPE_OOO_H */
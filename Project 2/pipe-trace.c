@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Writer and reader of the sim-pipe cache access trace, see pipe-trace.h
+   for the record format.  The reader maps the file a window at a time so
+   traces larger than the address space stream through. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "pipe-trace.h"
+
+/* zigzag encoding keeps small negative differences small */
+#define ZIGZAG(D) (((word_t)(D) << 1) ^ (word_t)((sword_t)(D) >> 31))
+#define UNZIGZAG(U) (((U) >> 1) ^ (0 - ((U) & 1)))
+
+static unsigned char* put_varint(unsigned char* p, word_t v) {
+  while (v >= 0x80) {
+    *p++ = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (unsigned char)v;
+  return p;
+}
+
+static void trace_flush(struct trace_writer* tw) {
+  if (tw->len && fwrite(tw->buf, 1, tw->len, tw->fp) != tw->len)
+    fatal("cannot write the cache trace");
+  tw->len = 0;
+}
+
+struct trace_writer* trace_open_write(char* fname) {
+  struct trace_writer* tw = (struct trace_writer*)calloc(1, sizeof(struct trace_writer));
+  if (!tw)
+    fatal("out of virtual memory");
+  tw->fp = fopen(fname, "wb");
+  if (!tw->fp)
+    fatal("cannot open cache trace `%s'", fname);
+  memcpy(tw->buf, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  tw->len = TRACE_MAGIC_LEN;
+  return tw;
+}
+
+void trace_put(struct trace_writer* tw, enum trace_kind kind, md_addr_t addr, md_addr_t pc) {
+  unsigned char* p;
+  if (tw->len + TRACE_MAX_RECORD > TRACE_BUF_SIZE)
+    trace_flush(tw);
+  p = tw->buf + tw->len;
+  *p++ = kind | (pc == tw->pc ? TRACE_SAME_PC : 0);
+  p = put_varint(p, ZIGZAG(addr - tw->last[kind]));
+  if (pc != tw->pc)
+    p = put_varint(p, ZIGZAG(pc - tw->pc));
+  tw->last[kind] = addr;
+  tw->pc = pc;
+  tw->len = p - tw->buf;
+  ++tw->records;
+}
+
+void trace_close_write(struct trace_writer* tw) {
+  trace_flush(tw);
+  fclose(tw->fp);
+  free(tw);
+}
+
+/* map the window holding file offset off, the next record */
+static void trace_map(struct trace_reader* tr, off_t off) {
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  if (tr->map)
+    munmap(tr->map, tr->len);
+  tr->base = off & ~(page - 1);
+  tr->len = tr->size - tr->base < TRACE_WINDOW ? tr->size - tr->base : TRACE_WINDOW;
+  tr->map = (unsigned char*)mmap(NULL, tr->len, PROT_READ, MAP_PRIVATE, tr->fd, tr->base);
+  if (tr->map == (unsigned char*)MAP_FAILED)
+    fatal("cannot map the cache trace");
+  madvise(tr->map, tr->len, MADV_SEQUENTIAL);
+  tr->p = tr->map + (off - tr->base);
+}
+
+struct trace_reader* trace_open_read(char* fname) {
+  struct stat st;
+  struct trace_reader* tr = (struct trace_reader*)calloc(1, sizeof(struct trace_reader));
+  if (!tr)
+    fatal("out of virtual memory");
+  tr->fd = open(fname, O_RDONLY);
+  if (tr->fd < 0 || fstat(tr->fd, &st) < 0)
+    fatal("cannot open cache trace `%s'", fname);
+  tr->size = st.st_size;
+  if (tr->size < TRACE_MAGIC_LEN)
+    fatal("`%s' is not a sim-pipe cache trace", fname);
+  trace_map(tr, 0);
+  if (memcmp(tr->p, TRACE_MAGIC, TRACE_MAGIC_LEN))
+    fatal("`%s' is not a sim-pipe cache trace", fname);
+  tr->p += TRACE_MAGIC_LEN;
+  return tr;
+}
+
+/* read the next record, returns 0 at the end of the trace */
+int trace_get(struct trace_reader* tr, enum trace_kind* kind, md_addr_t* addr, md_addr_t* pc) {
+  unsigned char* p = tr->p;
+  unsigned char* end = tr->map + tr->len;
+  word_t v;
+  int k, shift;
+
+  if (end - p < TRACE_MAX_RECORD) {
+    if (tr->base + (off_t)tr->len < tr->size) {
+      trace_map(tr, tr->base + (p - tr->map));
+      p = tr->p;
+      end = tr->map + tr->len;
+    }
+    if (p == end)
+      return 0;
+  }
+
+  k = *p & TRACE_KIND_MASK;
+  if (k >= TRACE_KINDS)
+    fatal("corrupt cache trace");
+  v = 0;
+  shift = 0;
+  do {
+    if (++p == end)
+      fatal("truncated cache trace");
+    v |= (word_t)(*p & 0x7f) << shift;
+    shift += 7;
+  } while (*p & 0x80);
+  tr->last[k] += UNZIGZAG(v);
+
+  if (!(*tr->p & TRACE_SAME_PC)) {
+    v = 0;
+    shift = 0;
+    do {
+      if (++p == end)
+        fatal("truncated cache trace");
+      v |= (word_t)(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p & 0x80);
+    tr->pc += UNZIGZAG(v);
+  }
+
+  tr->p = p + 1;
+  *kind = (enum trace_kind)k;
+  *addr = tr->last[k];
+  *pc = tr->pc;
+  return 1;
+}
+
+void trace_close_read(struct trace_reader* tr) {
+  munmap(tr->map, tr->len);
+  close(tr->fd);
+  free(tr);
+}
@@ -0,0 +1,63 @@
+/* binary trace of the cache accesses made by sim-pipe */
+#ifndef PIPE_TRACE_H
+#define PIPE_TRACE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "host.h"
+#include "machine.h"
+
+/* kind of a traced access */
+enum trace_kind {
+  TRACE_READ = 0,   /* dl1 load */
+  TRACE_WRITE,      /* dl1 store */
+  TRACE_IFETCH,     /* il1 fetch */
+  TRACE_KINDS
+};
+
+/*
+ * A trace file starts with the TRACE_MAGIC bytes. Each record is one byte
+ * holding the kind, with TRACE_SAME_PC set when the pc is the one of the
+ * record before, then the address minus the last address of the same kind
+ * and, unless TRACE_SAME_PC, the pc minus the pc before. Both differences
+ * are zigzag encoded and written as LEB128 varints, so a fetch or a stride
+ * walk takes two bytes a record.
+ */
+#define TRACE_MAGIC "SPTRACE1"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_KIND_MASK 3
+#define TRACE_SAME_PC 4
+#define TRACE_MAX_RECORD 11          /* kind byte and two 5 byte varints */
+#define TRACE_BUF_SIZE (64 << 10)    /* bytes buffered by the writer */
+#define TRACE_WINDOW (64 << 20)      /* bytes of the file mapped by the reader */
+
+struct trace_writer {
+  FILE* fp;
+  unsigned char buf[TRACE_BUF_SIZE];
+  unsigned int len;                  /* bytes used in buf */
+  md_addr_t last[TRACE_KINDS];       /* last address of each kind */
+  md_addr_t pc;                      /* pc of the last record */
+  counter_t records;
+};
+
+struct trace_reader {
+  int fd;
+  off_t size;                        /* bytes in the file */
+  off_t base;                        /* file offset of the window */
+  size_t len;                        /* bytes in the window */
+  unsigned char* map;                /* the mapped window */
+  unsigned char* p;                  /* next record in the window */
+  md_addr_t last[TRACE_KINDS];
+  md_addr_t pc;
+};
+
+struct trace_writer* trace_open_write(char* fname);
+void trace_put(struct trace_writer* tw, enum trace_kind kind, md_addr_t addr, md_addr_t pc);
+void trace_close_write(struct trace_writer* tw);
+
+struct trace_reader* trace_open_read(char* fname);
+int trace_get(struct trace_reader* tr, enum trace_kind* kind, md_addr_t* addr, md_addr_t* pc);
+void trace_close_read(struct trace_reader* tr);
+
+#endif /* PIPE_TRACE_H */
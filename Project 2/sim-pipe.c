@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 /* An implementation of 5-stage classic pipeline simulation */
 
@@ -17,6 +21,8 @@
 #include "dlite.h"
 #include "sim.h"
 #include "sim-pipe.h"
+#include "pipe-trace.h"
+#include "checkpoint.h"
 
 /* simulated registers */
 static struct regs_t regs;
@@ -24,6 +30,126 @@ static struct regs_t regs;
 /* simulated memory */
 static struct mem_t *mem = NULL;
 
+/* cache access trace file, NULL for none */
+static char *trace_name;
+
+/* cache access trace writer */
+static struct trace_writer *trace = NULL;
+
+/* number of instructions executed functionally before the pipeline starts */
+static int fastfwd_count;
+
+/* run the fast forward accesses through the caches */
+static int fastfwd_warm;
+
+/* cycles from EX to the HI/LO result of a multiply and a divide, and
+   between two of them entering the multiply/divide unit */
+static int mult_lat;
+static int mult_ii;
+static int div_lat;
+static int div_ii;
+
+/* instructions in a latch, and the ALUs, memory ports and FP units an ID
+   group may use */
+static int pipe_width;
+static int pipe_alu;
+static int pipe_mem;
+static int pipe_fpu;
+
+/* units of each fu_group() an ID group may use */
+static int fu_max[5];
+
+/* instructions executed by the fast forward */
+static counter_t sim_num_fastfwd = 0;
+
+/* simpoint file written by sim-fast, NULL to simulate the whole run */
+static char *sp_name;
+
+/* simpoints read from it, in the order of the run: the interval of each
+   and the fraction of all intervals it stands for */
+static int sp_npoints = 0;
+static counter_t *sp_point = NULL;
+static double *sp_weight = NULL;
+
+/* instructions of the whole run and of an interval */
+static counter_t sp_insn = 0;
+static counter_t sp_interval = 0;
+
+/* instructions simulated by the pipeline in a sampled run */
+static counter_t sim_num_sampled = 0;
+
+/* levels the estimates cover, the L2 only if there is one */
+static struct cache *sp_caches[] = { &il1, &dl1, &l2 };
+#define SP_NCACHES	(l2.isEnabled ? 3 : 2)
+
+/* estimates of the whole run from the simpoints or the checkpoint
+   windows */
+static double sp_est_cycles = 0.0;
+static double sp_est_access[3], sp_est_miss[3];
+
+/* what the pipeline measured over one sample */
+struct sample_res {
+  counter_t insn;                   /* instructions fetched */
+  counter_t cycles;                 /* clock cycles */
+  counter_t access[3];              /* accesses and misses of each level */
+  counter_t miss[3];
+  int done;                         /* set once the sample ran to its end */
+};
+
+/* instructions the pipeline fetches before it drains, 0 for no limit */
+static counter_t fetch_limit = 0;
+static counter_t fetch_count = 0;
+
+/* set once fetching stopped, with the PC the run goes on from */
+static int fetch_stopped = FALSE;
+static md_addr_t fetch_resume;
+
+/* checkpoint to write, NULL for none, and the instructions of the run
+   fetched before it */
+static char *ckpt_name;
+static int ckpt_at;
+
+/* checkpoint to start from, NULL to load the program */
+static char *ckpt_load_name;
+
+/* instructions of the run fast forwarded or fetched so far, counted from
+   the program entry even when starting from a checkpoint */
+static counter_t run_insn = 0;
+
+/* set if the latches came from a checkpoint, the pipeline goes on with
+   them instead of starting empty */
+static int pipe_restored = FALSE;
+
+/* checkpoint list written by sim-fast -ckpt:every, NULL for none; the
+   window after each checkpoint is simulated in a worker process of its
+   own, and the whole run estimated from the windows */
+static char *ckpt_sample_name;
+
+/* instructions simulated after each checkpoint, and the workers run at
+   once, 0 for one per host processor */
+static int ckpt_window;
+static int ckpt_jobs;
+
+/* the checkpoints of the list and the instructions run before each */
+static int ck_num = 0;
+static char **ck_file = NULL;
+static counter_t *ck_insn = NULL;
+
+/* results of the windows, shared with the workers; a worker measures up
+   to every system call too, so a window the program exits in still
+   counts for the instructions it ran */
+static struct sample_res *ck_res = NULL;
+static struct sample_res *ck_worker = NULL;
+
+static void fast_forward(counter_t count);
+static void sp_read(char *fname);
+static void pipe_state(FILE *fp, int save);
+static void ckpt_take();
+static void ckpt_read_index(char *fname);
+static void sample_measure(struct sample_res *res);
+static void parallel_run();
+static void ooo_run();
+
 /* register simulator-specific options */
 void
 sim_reg_options(struct opt_odb_t *odb)
@@ -31,6 +157,100 @@ sim_reg_options(struct opt_odb_t *odb)
   opt_reg_header(odb, 
 "sim-pipe: This simulator implements based on sim-fast.\n"
 		 );
+
+  cache_reg_options(odb);
+
+  bpred_reg_options(odb);
+
+  ooo_reg_options(odb);
+
+  opt_reg_string(odb, "-cache:trace",
+		 "write every cache access to this trace file",
+		 &trace_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-pipe:width",
+	      "instructions fetched, decoded, executed and written back in "
+	      "a cycle",
+	      &pipe_width, /* default */1,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-pipe:alu",
+	      "integer ALU operations issued in a cycle",
+	      &pipe_alu, /* default */4,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-pipe:mem",
+	      "loads and stores issued in a cycle",
+	      &pipe_mem, /* default */1,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-pipe:fpu",
+	      "floating point operations issued in a cycle",
+	      &pipe_fpu, /* default */1,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-mdu:mult:lat",
+	      "cycles from EX until the HI/LO result of a multiply can be read",
+	      &mult_lat, /* default */3,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-mdu:mult:ii",
+	      "cycles between two multiplies entering the multiply/divide unit",
+	      &mult_ii, /* default */1,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-mdu:div:lat",
+	      "cycles from EX until the HI/LO result of a divide can be read",
+	      &div_lat, /* default */20,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-mdu:div:ii",
+	      "cycles between two divides entering the multiply/divide unit",
+	      &div_ii, /* default */19,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_int(odb, "-fastfwd",
+	      "number of insts executed functionally before the pipeline starts",
+	      &fastfwd_count, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+
+  opt_reg_flag(odb, "-fastfwd:warm",
+	       "warm the caches up with the fast forwarded accesses",
+	       &fastfwd_warm, /* default */FALSE,
+	       /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-simpoint",
+		 "simulate only the simpoints of this file (from sim-fast "
+		 "-simpoint:file) and estimate the whole run",
+		 &sp_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-ckpt:save",
+		 "write a checkpoint of the pipeline, the caches and the "
+		 "architected state to this file",
+		 &ckpt_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ckpt:at",
+	      "instructions of the run fetched before the checkpoint is "
+	      "written",
+	      &ckpt_at, /* default */0,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_string(odb, "-ckpt:load",
+		 "start from this checkpoint (of sim-pipe or sim-fast) instead "
+		 "of the program entry",
+		 &ckpt_load_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+
+  opt_reg_string(odb, "-ckpt:sample",
+		 "simulate a window after each checkpoint of this list (from "
+		 "sim-fast -ckpt:every) in parallel and estimate the whole run",
+		 &ckpt_sample_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ckpt:window",
+	      "instructions simulated after each checkpoint (and its fast "
+	      "forward) of -ckpt:sample",
+	      &ckpt_window, /* default */10000,
+	      /* print */TRUE, /* format */NULL);
+  opt_reg_int(odb, "-ckpt:jobs",
+	      "windows of -ckpt:sample simulated at once, 0 for one per "
+	      "processor",
+	      &ckpt_jobs, /* default */0,
+	      /* print */TRUE, /* format */NULL);
 }
 
 /* check simulator-specific option values */
@@ -39,6 +259,61 @@ sim_check_options(struct opt_odb_t *odb, int argc, char **argv)
 {
   if (dlite_active)
     fatal("sim-pipe does not support DLite debugging");
+
+  if (pipe_width < 1 || pipe_width > MAX_WIDTH)
+    fatal("pipeline width must be between 1 and %d", MAX_WIDTH);
+  if (pipe_alu < 1 || pipe_mem < 1 || pipe_fpu < 1)
+    fatal("there must be at least one ALU, memory port and FP unit");
+  fu_max[0] = MAX_WIDTH;
+  fu_max[1] = pipe_alu;
+  fu_max[2] = 1;
+  fu_max[3] = pipe_mem;
+  fu_max[4] = pipe_fpu;
+
+  if (mult_lat < 1 || mult_ii < 1 || div_lat < 1 || div_ii < 1)
+    fatal("multiply/divide latencies and intervals must be at least 1");
+
+  if (fastfwd_count < 0)
+    fatal("bad fast forward count: %d", fastfwd_count);
+
+  if (sp_name) {
+    if (fastfwd_count)
+      fatal("-fastfwd and -simpoint do not mix");
+    /* the caches are never left cold between simpoints, so no line the
+       pipeline filled hides a store of the fast forward */
+    fastfwd_warm = TRUE;
+    sp_read(sp_name);
+  }
+
+  if (ckpt_name) {
+    if (sp_name)
+      fatal("-ckpt:save and -simpoint do not mix");
+    if (ckpt_at <= fastfwd_count)
+      fatal("-ckpt:at must be past the fast forward");
+  }
+  if (ckpt_load_name && sp_name)
+    fatal("-ckpt:load and -simpoint do not mix");
+
+  if (ckpt_sample_name) {
+    if (sp_name || ckpt_name || ckpt_load_name)
+      fatal("-ckpt:sample does not mix with -simpoint, -ckpt:save or "
+            "-ckpt:load");
+    if (ckpt_window < 1)
+      fatal("-ckpt:window must be at least 1");
+    if (ckpt_jobs < 0)
+      fatal("bad number of jobs: %d", ckpt_jobs);
+    if (!ckpt_jobs)
+      ckpt_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ckpt_jobs < 1)
+      ckpt_jobs = 1;
+    ckpt_read_index(ckpt_sample_name);
+  }
+
+  cache_check_options();
+  bpred_check_options();
+  ooo_check_options();
+  if (ooo.enabled && (sp_name || ckpt_name || ckpt_load_name || ckpt_sample_name))
+    fatal("-ooo does not mix with -simpoint or the checkpoints");
 }
 
 /* register simulator-specific statistics */
@@ -58,19 +333,52 @@ sim_reg_stats(struct stat_sdb_t *sdb)
 		   "simulation speed (in insts/sec)",
 		   "sim_num_insn / sim_elapsed_time", NULL);
 #endif /* !NO_INSN_COUNT */
+  stat_reg_counter(sdb, "sim_num_fastfwd",
+		   "total number of instructions fast forwarded",
+		   &sim_num_fastfwd, sim_num_fastfwd, NULL);
+  if (sp_name || ckpt_sample_name) {
+    char buf[128], buf1[128];
+    int i;
+
+    stat_reg_counter(sdb, "sim_num_sampled",
+		     "total number of instructions simulated in the pipeline",
+		     &sim_num_sampled, sim_num_sampled, NULL);
+    stat_reg_counter(sdb, "sp_num_insn",
+		     "instructions of the whole run, from the simpoint file or "
+		     "the checkpoint list",
+		     &sp_insn, sp_insn, NULL);
+    stat_reg_double(sdb, "sp_est_cycles",
+		    "estimated cycles of the whole run",
+		    &sp_est_cycles, 0.0, NULL);
+    stat_reg_formula(sdb, "sp_est_cpi",
+		     "estimated cycles per instruction of the whole run",
+		     "sp_est_cycles / sp_num_insn", NULL);
+    for (i = 0; i < SP_NCACHES; ++i) {
+      sprintf(buf, "%s.sp_est_accesses", sp_caches[i]->name);
+      stat_reg_double(sdb, buf, "estimated accesses of the whole run",
+		      &sp_est_access[i], 0.0, NULL);
+      sprintf(buf, "%s.sp_est_misses", sp_caches[i]->name);
+      stat_reg_double(sdb, buf, "estimated misses of the whole run",
+		      &sp_est_miss[i], 0.0, NULL);
+      sprintf(buf, "%s.sp_est_miss_rate", sp_caches[i]->name);
+      sprintf(buf1, "%s.sp_est_misses / %s.sp_est_accesses",
+	      sp_caches[i]->name, sp_caches[i]->name);
+      stat_reg_formula(sdb, buf, "estimated miss rate of the whole run",
+		       buf1, NULL);
+    }
+  }
   ld_reg_stats(sdb);
   mem_reg_stats(mem, sdb);
 }
 
-struct ifid_buf fd;
-struct idex_buf de;
-struct exmem_buf em;
-struct memwb_buf mw;
-struct wb_buf wb;
+struct ifid_buf fd[MAX_WIDTH];
+struct idex_buf de[MAX_WIDTH];
+struct exmem_buf em[MAX_WIDTH];
+struct memwb_buf mw[MAX_WIDTH];
+struct wb_buf wb[MAX_WIDTH];
 struct control_buf ctl;
 
 unsigned int sim_num_cycle;
-struct cache cache;
 
 #define DNA			(-1)
 
@@ -116,54 +424,70 @@ sim_init(void)
   /* CTL */
   ctl_init();
   /* Cache */
-  cache_init();
+  cache_init(mem);
+  /* Branch predictor */
+  bpred_init();
+  /* Out-of-order engine */
+  ooo_init();
+  if (trace_name)
+    trace = trace_open_write(trace_name);
 }
 
 void fd_init() {
-  fd.inst.a = NOP;
-  fd.PC = 0;
-  fd.NPC = 0;
+  int i;
+  for (i = 0; i < MAX_WIDTH; ++i) {
+    fd[i].inst.a = NOP;
+    fd[i].PC = 0;
+    fd[i].NPC = 0;
+  }
 }
 
 void de_init() {
-  de.inst.a = NOP;
-  de.PC = 0;
-  de.iflags = 0;
-  de.func = 0;
-  de.srcA = 0;
-  de.srcB = 0;
-  de.busA = 0;
-  de.busB = 0;
-  de.sw = 0;
-  de.dstR = DNA;
-  de.dstM = DNA;
-  de.rwflag = 0;
-  de.target = 0;
+  int i;
+  for (i = 0; i < MAX_WIDTH; ++i) {
+    de[i].inst.a = NOP;
+    de[i].PC = 0;
+    de[i].NPC = 0;
+    de[i].iflags = 0;
+    de[i].dstR = DNA;
+    de[i].dstM = DNA;
+    de[i].ldmask = 0;
+    de[i].rwflag = 0;
+  }
 }
 
 void em_init() {
-  em.inst.a = NOP;
-  em.PC = 0;
-  em.alu = 0;
-  em.sw = 0;
-  em.dstR = DNA;
-  de.dstM = DNA;
-  em.rwflag = 0;
-  em.target = 0;
+  int i;
+  for (i = 0; i < MAX_WIDTH; ++i) {
+    em[i].inst.a = NOP;
+    em[i].PC = 0;
+    em[i].alu = 0;
+    em[i].dstR = DNA;
+    em[i].dstM = DNA;
+    em[i].ldmask = 0;
+    em[i].rwflag = 0;
+  }
 }
 
 void mw_init() {
-  mw.inst.a = NOP;
-  mw.PC = 0;
-  mw.memLoad = 0;
-  mw.dstR = DNA;
-  de.dstM = DNA;
-  mw.rwflag = 0;
+  int i;
+  for (i = 0; i < MAX_WIDTH; ++i) {
+    mw[i].inst.a = NOP;
+    mw[i].PC = 0;
+    mw[i].memLoad = 0;
+    mw[i].dstR = DNA;
+    mw[i].dstM = DNA;
+    mw[i].ldmask = 0;
+    mw[i].rwflag = 0;
+  }
 }
 
 void wb_init() {
-  wb.inst.a = NOP;
-  wb.PC = 0;
+  int i;
+  for (i = 0; i < MAX_WIDTH; ++i) {
+    wb[i].inst.a = NOP;
+    wb[i].PC = 0;
+  }
 }
 
 void ctl_init() {
@@ -171,15 +495,13 @@ void ctl_init() {
   ctl.cond = 0;
   ctl.dst = 0;
   ctl.dh = 0;
-}
-
-void cache_init() {
-  cache.isEnabled = 1;
-  cache.accessCounter = 0;
-  cache.hitCounter = 0;
-  cache.missCounter = 0;
-  cache.replaceCounter = 0;
-  cache.wbCounter = 0;
+  ctl.miss = 0;
+  ctl.hilo = 0;
+  ctl.mdu = 0;
+  ctl.target = 0;
+  ctl.stall = 0;
+  ctl.commitCounter = 0;
+  ctl.splitCounter = 0;
 }
 
 /* load program into simulated state */
@@ -188,8 +510,37 @@ sim_load_prog(char *fname,		/* program to load */
 	      int argc, char **argv,	/* program arguments */
 	      char **envp)		/* program environment */
 {
-  /* load program text and data, set up environment, memory, and regs */
-  ld_load_prog(fname, argc, argv, envp, &regs, mem, TRUE);
+  struct ckpt_header hdr;
+  FILE *fp;
+
+  /* the workers of a sampled run each load a checkpoint of their own */
+  if (ckpt_sample_name)
+    return;
+
+  if (!ckpt_load_name) {
+    /* load program text and data, set up environment, memory, and regs */
+    ld_load_prog(fname, argc, argv, envp, &regs, mem, TRUE);
+    return;
+  }
+
+  /* the checkpoint stands for the loaded program, run up to it; one of
+     sim-fast starts the pipeline empty at its PC, one of sim-pipe brings
+     back the instructions in flight and the caches as well */
+  fp = ckpt_load(ckpt_load_name, &hdr, &regs, mem);
+  if (!strcmp(hdr.sim, "sim-pipe")) {
+    pipe_state(fp, FALSE);
+    cache_restore(fp);
+    bpred_restore(fp);
+    pipe_restored = TRUE;
+  } else if (hdr.sim[0]) {
+    fatal("checkpoint `%s' holds %s state, not sim-pipe's", ckpt_load_name,
+          hdr.sim);
+  }
+  fclose(fp);
+  run_insn = hdr.insn;
+  if (ckpt_name && ckpt_at <= run_insn + fastfwd_count)
+    fatal("-ckpt:at must be past the checkpoint `%s' and the fast forward",
+          ckpt_load_name);
 }
 
 /* print simulator-specific configuration information */
@@ -207,7 +558,12 @@ sim_aux_stats(FILE *stream)
 /* un-initialize simulator-specific state */
 void 
 sim_uninit(void)
-{ /* nada */ }
+{
+  if (trace) {
+    trace_close_write(trace);
+    trace = NULL;
+  }
+}
 
 
 /*
@@ -223,7 +579,8 @@ sim_uninit(void)
 /* general purpose registers */
 #define GPR(N)			(regs.regs_R[N])
 #define SET_GPR(N,EXPR)		(regs.regs_R[N] = (EXPR))
-#define DECLARE_FAULT(EXP) 	{;}
+#define DECLARE_FAULT(FAULT)						\
+  { fault = (FAULT); break; }
 #if defined(TARGET_PISA)
 
 /* floating point registers, L->word, F->single-prec, D->double-prec */
@@ -244,24 +601,84 @@ sim_uninit(void)
 
 #endif
 
-/* precise architected memory state accessor macros */
+/* cycles of the loads and stores of the instruction in MEM */
+static unsigned int mem_cycles;
+
+/* word address of the last load or store */
+static md_addr_t mem_addr;
+
+/* read SIZE bytes at ADDR through dl1, for the instruction at regs_PC */
+static word_t
+pipe_read(md_addr_t addr, int size)
+{
+  word_t word, val = 0;
+
+  mem_addr = addr & ~3;
+  if (trace)
+    trace_put(trace, TRACE_READ, addr & ~3, regs.regs_PC);
+  if (!dl1.isEnabled) {
+    mem_cycles += MISS_LATENCY;
+    switch (size) {
+    case 1: return MEM_READ_BYTE(mem, addr);
+    case 2: return MEM_READ_HALF(mem, addr);
+    default: return MEM_READ_WORD(mem, addr);
+    }
+  }
+  mem_cycles += cache_read(&dl1, addr & ~3, regs.regs_PC, &word);
+  memcpy(&val, (char *)&word + (addr & 3), size);
+  return val;
+}
+
+/* write the SIZE low bytes of VAL at ADDR through dl1, a byte or half
+   word store reads the word first, as the caches are written a word at a
+   time */
+static void
+pipe_write(md_addr_t addr, word_t val, int size)
+{
+  word_t word;
+
+  mem_addr = addr & ~3;
+  if (!dl1.isEnabled) {
+    if (trace)
+      trace_put(trace, TRACE_WRITE, addr & ~3, regs.regs_PC);
+    mem_cycles += MISS_LATENCY;
+    switch (size) {
+    case 1: MEM_WRITE_BYTE(mem, addr, val); break;
+    case 2: MEM_WRITE_HALF(mem, addr, val); break;
+    default: MEM_WRITE_WORD(mem, addr, val); break;
+    }
+    return;
+  }
+  if (size < 4) {
+    word = pipe_read(addr & ~3, 4);
+    memcpy((char *)&word + (addr & 3), &val, size);
+  } else {
+    word = val;
+  }
+  if (trace)
+    trace_put(trace, TRACE_WRITE, addr & ~3, regs.regs_PC);
+  mem_cycles += cache_write(&dl1, addr & ~3, regs.regs_PC, &word);
+}
+
+/* precise architected memory state accessor macros, the loads and stores
+   of the pipeline go through the caches */
 #define READ_BYTE(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, MEM_READ_BYTE(mem, (SRC)))
+  ((FAULT) = md_fault_none, pipe_read((SRC), 1))
 #define READ_HALF(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, MEM_READ_HALF(mem, (SRC)))
+  ((FAULT) = md_fault_none, pipe_read((SRC), 2))
 #define READ_WORD(SRC, FAULT)						\
-  ((FAULT) = md_fault_none, MEM_READ_WORD(mem, (SRC)))
+  ((FAULT) = md_fault_none, pipe_read((SRC), 4))
 #ifdef HOST_HAS_QWORD
 #define READ_QWORD(SRC, FAULT)						\
   ((FAULT) = md_fault_none, MEM_READ_QWORD(mem, (SRC)))
 #endif /* HOST_HAS_QWORD */
 
 #define WRITE_BYTE(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_BYTE(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, pipe_write((DST), (SRC), 1))
 #define WRITE_HALF(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_HALF(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, pipe_write((DST), (SRC), 2))
 #define WRITE_WORD(SRC, DST, FAULT)					\
-  ((FAULT) = md_fault_none, MEM_WRITE_WORD(mem, (DST), (SRC)))
+  ((FAULT) = md_fault_none, pipe_write((DST), (SRC), 4))
 #ifdef HOST_HAS_QWORD
 #define WRITE_QWORD(SRC, DST, FAULT)					\
   ((FAULT) = md_fault_none, MEM_WRITE_QWORD(mem, (DST), (SRC)))
@@ -288,13 +705,68 @@ sim_main(void)
   if (sim_swap_bytes || sim_swap_words)
     fatal("sim: *pipe* functional simulation cannot swap bytes or words");
 
-  /* set up initial default next PC */
-  regs.regs_NPC = regs.regs_PC + sizeof(md_inst_t);
-  /* maintain $r0 semantics */
-  regs.regs_R[MD_REG_ZERO] = 0;
+  if (sp_name) {
+    sample_run();
+    return;
+  }
+  if (ckpt_sample_name) {
+    parallel_run();
+    return;
+  }
 
-  /* initalize PC */
-  fd.PC = regs.regs_PC - sizeof(md_inst_t);
+  /* skip the first instructions with the sim-fast engine, the pipeline
+     then starts from the architected state they leave */
+  if (fastfwd_count > 0) {
+    fast_forward(fastfwd_count);
+    if (fastfwd_warm) {
+      cache_end_warmup();
+      bpred_end_warmup();
+    }
+  }
+
+  if (ooo.enabled)
+    ooo_run();
+  else
+    pipe_run(0);
+}
+
+/* TRUE once ID, EX and MEM hold no instruction */
+static int pipe_drained() {
+  int i;
+  for (i = 0; i < pipe_width; ++i) {
+    if (de[i].inst.a != NOP || em[i].inst.a != NOP || mw[i].inst.a != NOP)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* run the pipeline from regs.regs_PC; with COUNT > 0, fetching stops after
+   COUNT instructions, the ones in flight drain, and regs.regs_PC is left
+   at the next one */
+void pipe_run(counter_t count) {
+  fetch_limit = count;
+  fetch_count = 0;
+  fetch_stopped = FALSE;
+
+  /* go on with the latches of a checkpoint, or start from empty ones */
+  if (pipe_restored) {
+    pipe_restored = FALSE;
+  } else {
+    fd_init();
+    de_init();
+    em_init();
+    mw_init();
+    wb_init();
+    ctl_init();
+
+    /* set up initial default next PC */
+    regs.regs_NPC = regs.regs_PC + sizeof(md_inst_t);
+    /* maintain $r0 semantics */
+    regs.regs_R[MD_REG_ZERO] = 0;
+
+    /* the first fetch */
+    fd[pipe_width - 1].NPC = regs.regs_PC;
+  }
 
   while (TRUE)
   {
@@ -306,444 +778,941 @@ sim_main(void)
     do_ex();
     do_id();
     do_if();
+    /* a fetch group may step over the count */
+    if (ckpt_name && run_insn >= ckpt_at)
+      ckpt_take();
     /* print current trace */
     //do_log();
+    if (fetch_stopped && pipe_drained())
+      break;
+  }
+  regs.regs_PC = fetch_resume;
+}
+
+/* write or read back the latches and the counters of the pipeline */
+static void pipe_state(FILE *fp, int save) {
+  void (*io)(FILE*, void*, size_t) = save ? ckpt_write : ckpt_read;
+  int width = pipe_width;
+  io(fp, &width, sizeof(width));
+  if (width != pipe_width)
+    fatal("checkpoint was taken with -pipe:width %d", width);
+  io(fp, &fd, sizeof(fd));
+  io(fp, &de, sizeof(de));
+  io(fp, &em, sizeof(em));
+  io(fp, &mw, sizeof(mw));
+  io(fp, &wb, sizeof(wb));
+  io(fp, &ctl, sizeof(ctl));
+  io(fp, &sim_num_insn, sizeof(sim_num_insn));
+  io(fp, &sim_num_cycle, sizeof(sim_num_cycle));
+  io(fp, &sim_num_fastfwd, sizeof(sim_num_fastfwd));
+}
+
+/* write the checkpoint: the architected state, then the latches, the
+   counters and the caches, so a run started from it goes on cycle for
+   cycle as this one does */
+static void ckpt_take() {
+  FILE *fp;
+
+  fprintf(stderr, "sim: ** checkpoint at %.0f insts, cycle %u **\n",
+          (double)run_insn, sim_num_cycle);
+  fp = ckpt_save(ckpt_name, "sim-pipe", run_insn, &regs, mem);
+  pipe_state(fp, TRUE);
+  cache_save(fp);
+  bpred_save(fp);
+  fclose(fp);
+  ckpt_name = NULL;
+}
+
+/* take what the pipeline measured since the counters were last cleared */
+static void sample_measure(struct sample_res *res) {
+  int i;
+  res->insn = fetch_count;
+  res->cycles = sim_num_cycle;
+  for (i = 0; i < SP_NCACHES; ++i) {
+    res->access[i] = sp_caches[i]->accessCounter;
+    res->miss[i] = sp_caches[i]->missCounter;
   }
 }
 
-void forward(int *val, int *src) {
-  if(*src != DNA) {
-    if(*src == em.dstR) {
-      *val = em.alu;
-    } else if(*src == mw.dstM) {
-      *val = mw.memLoad;      
+/* add a sample, scaled by given factor, to the estimates of the whole run */
+static void sample_add(struct sample_res *res, double scale) {
+  int i;
+  sp_est_cycles += scale * res->cycles;
+  for (i = 0; i < SP_NCACHES; ++i) {
+    sp_est_access[i] += scale * res->access[i];
+    sp_est_miss[i] += scale * res->miss[i];
+  }
+}
+
+/* simulate only the simpoints in the pipeline, fast forwarding with warm
+   caches between them; each one stands for its weight of the run, so what
+   it measures per instruction is scaled up by its weight times the
+   instructions of the run */
+void sample_run() {
+  struct sample_res res;
+  counter_t pos = 0, start;
+  int i;
+
+  for (i = 0; i < sp_npoints; ++i) {
+    start = sp_point[i] * sp_interval;
+    if (start > pos)
+      fast_forward(start - pos);
+    /* the pipeline measures from a clean clock and counters */
+    cache_end_warmup();
+    bpred_end_warmup();
+    fprintf(stderr, "sim: ** simpoint %d: interval %.0f, weight %.4f **\n",
+            i, (double)sp_point[i], sp_weight[i]);
+    pipe_run(sp_interval);
+    sim_num_sampled += sp_interval;
+    sample_measure(&res);
+    sample_add(&res, sp_weight[i] * sp_insn / sp_interval);
+    pos = start + sp_interval;
+  }
+}
+
+/* read the simpoints of a sim-fast run: lines "insn N", "interval N" and
+   "point INTERVAL WEIGHT" in the order of the run, and # comments */
+static void sp_read(char *fname) {
+  FILE *fd;
+  char line[256];
+  double val, weight;
+
+  fd = fopen(fname, "r");
+  if (!fd)
+    fatal("cannot open simpoint file `%s'", fname);
+  while (fgets(line, sizeof(line), fd)) {
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "insn %lf", &val) == 1) {
+      sp_insn = (counter_t)val;
+    } else if (sscanf(line, "interval %lf", &val) == 1) {
+      sp_interval = (counter_t)val;
+    } else if (sscanf(line, "point %lf %lf", &val, &weight) == 2) {
+      if (sp_npoints && (counter_t)val <= sp_point[sp_npoints - 1])
+        fatal("simpoints of `%s' are not in the order of the run", fname);
+      sp_point = (counter_t*)realloc(sp_point, (sp_npoints + 1) * sizeof(counter_t));
+      sp_weight = (double*)realloc(sp_weight, (sp_npoints + 1) * sizeof(double));
+      if (!sp_point || !sp_weight)
+        fatal("out of virtual memory");
+      sp_point[sp_npoints] = (counter_t)val;
+      sp_weight[sp_npoints++] = weight;
     } else {
-      *val = GPR(*src);      
+      fatal("bad line in simpoint file `%s': %s", fname, line);
+    }
+  }
+  fclose(fd);
+  if (!sp_insn || !sp_interval || !sp_npoints)
+    fatal("simpoint file `%s' needs insn, interval and point lines", fname);
+}
+
+/* simulate the window after checkpoint K in a worker: fast forward from
+   it if asked, then run the pipeline for a window from a clean clock and
+   counters */
+static void parallel_worker(int k) {
+  struct ckpt_header hdr;
+  FILE *fp;
+
+  fp = ckpt_load(ck_file[k], &hdr, &regs, mem);
+  if (hdr.sim[0])
+    fatal("checkpoint `%s' holds %s state in flight, -ckpt:sample takes "
+          "the architected ones of sim-fast", ck_file[k], hdr.sim);
+  fclose(fp);
+  run_insn = hdr.insn;
+  if (fastfwd_count > 0)
+    fast_forward(fastfwd_count);
+  cache_end_warmup();
+  bpred_end_warmup();
+  sim_num_insn = 0;
+  ck_worker = &ck_res[k];
+  pipe_run(ckpt_window);
+  sample_measure(ck_worker);
+  ck_worker->done = TRUE;
+  fflush(stdout);
+  _exit(0);
+}
+
+/* simulate the window after every checkpoint of the list, at most
+   ckpt_jobs at a time; the pipeline and the caches keep their state in
+   globals, so each window runs in a process of its own, forked before any
+   program is loaded, and only the results are shared.  Window K stands
+   for the instructions up to the next checkpoint, so what it measured per
+   instruction is scaled up by them; windows the program never reached
+   are left out and the others scaled up to the whole run */
+static void parallel_run() {
+  pid_t *pid, p;
+  FILE **out;
+  char line[1024];
+  int k, next = 0, running = 0, status, failed = 0;
+  double covered = 0.0, unit;
+  counter_t end;
+
+  ck_res = (struct sample_res*)mmap(NULL, ck_num * sizeof(struct sample_res),
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ck_res == (struct sample_res*)MAP_FAILED)
+    fatal("cannot map the results of the windows");
+  memset(ck_res, 0, ck_num * sizeof(struct sample_res));
+  pid = (pid_t*)calloc(ck_num, sizeof(pid_t));
+  out = (FILE**)calloc(ck_num, sizeof(FILE*));
+  if (!pid || !out)
+    fatal("out of virtual memory");
+
+  fprintf(stderr, "sim: ** %d windows of %d insts, %d at a time **\n",
+          ck_num, ckpt_window, ckpt_jobs);
+  fflush(stdout);
+  fflush(stderr);
+  while (next < ck_num || running) {
+    if (next < ck_num && running < ckpt_jobs) {
+      /* the output of a worker is only shown if it fails */
+      out[next] = tmpfile();
+      if (!out[next])
+        fatal("cannot create a worker output file");
+      pid[next] = fork();
+      if (pid[next] < 0)
+        fatal("cannot fork a worker");
+      if (pid[next] == 0) {
+        dup2(fileno(out[next]), fileno(stdout));
+        dup2(fileno(out[next]), fileno(stderr));
+        parallel_worker(next);
+      }
+      ++next;
+      ++running;
+      continue;
+    }
+    p = wait(&status);
+    if (p < 0)
+      fatal("lost a worker");
+    for (k = 0; k < next && pid[k] != p; ++k)
+      ;
+    if (k == next)
+      continue;
+    --running;
+    if (!ck_res[k].done && !(WIFEXITED(status) && ck_res[k].insn)) {
+      ++failed;
+      ck_res[k].insn = 0;
+      if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+        fprintf(stderr, "sim: ** window %d: the program exited before it **\n", k);
+      } else {
+        fprintf(stderr, "sim: ** window %d failed, its output: **\n", k);
+        rewind(out[k]);
+        while (fgets(line, sizeof(line), out[k]))
+          fputs(line, stderr);
+      }
+    }
+    fclose(out[k]);
+  }
+
+  for (k = 0; k < ck_num; ++k) {
+    if (ck_res[k].insn)
+      covered += (k + 1 < ck_num ? ck_insn[k + 1] : sp_insn) - ck_insn[k];
+  }
+  if (covered == 0.0)
+    fatal("no window was simulated");
+  for (k = 0; k < ck_num; ++k) {
+    if (!ck_res[k].insn)
+      continue;
+    end = k + 1 < ck_num ? ck_insn[k + 1] : sp_insn;
+    unit = (double)(end - ck_insn[k]);
+    fprintf(stderr, "sim: ** window %d at %.0f: %.0f insts, %.0f cycles **\n",
+            k, (double)ck_insn[k], (double)ck_res[k].insn,
+            (double)ck_res[k].cycles);
+    sim_num_sampled += ck_res[k].insn;
+    sample_add(&ck_res[k], unit / ck_res[k].insn * sp_insn / covered);
+  }
+  if (failed)
+    warn("%d of %d windows were not simulated", failed, ck_num);
+  free(pid);
+  free(out);
+}
+
+/* read the checkpoint list of a sim-fast -ckpt:every run: lines "insn N",
+   "every N" and "ckpt FILE INSN" in the order of the run, and # comments */
+static void ckpt_read_index(char *fname) {
+  FILE *fd;
+  char line[1280], file[1024];
+  double val;
+
+  fd = fopen(fname, "r");
+  if (!fd)
+    fatal("cannot open checkpoint list `%s'", fname);
+  while (fgets(line, sizeof(line), fd)) {
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "insn %lf", &val) == 1) {
+      sp_insn = (counter_t)val;
+    } else if (sscanf(line, "every %lf", &val) == 1) {
+      /* the spacing follows from the checkpoints themselves */
+    } else if (sscanf(line, "ckpt %1023s %lf", file, &val) == 2) {
+      if (ck_num && (counter_t)val <= ck_insn[ck_num - 1])
+        fatal("checkpoints of `%s' are not in the order of the run", fname);
+      ck_file = (char**)realloc(ck_file, (ck_num + 1) * sizeof(char*));
+      ck_insn = (counter_t*)realloc(ck_insn, (ck_num + 1) * sizeof(counter_t));
+      if (!ck_file || !ck_insn)
+        fatal("out of virtual memory");
+      ck_file[ck_num] = strdup(file);
+      ck_insn[ck_num++] = (counter_t)val;
+    } else {
+      fatal("bad line in checkpoint list `%s': %s", fname, line);
     }
-  } else {
-    *val = 0;
   }
+  fclose(fd);
+  if (!sp_insn || !ck_num)
+    fatal("checkpoint list `%s' needs insn and ckpt lines", fname);
+  if (ck_insn[ck_num - 1] >= sp_insn)
+    fatal("checkpoints of `%s' are past the end of the run", fname);
 }
 
-void do_forward() {
-  forward(&de.busA, &de.srcA);
-  forward(&de.busB, &de.srcB);
-  forward(&de.sw, &de.oprand.in1);
+#ifdef HOST_HAS_QWORD
+/* MULT and MULTU with one host multiply, instead of the bit-serial loop
+   of machine.def */
+static void
+mdu_mult(md_inst_t inst, enum md_opcode op)
+{
+  qword_t prod;
+
+  if (op == MULT)
+    prod = (qword_t)((sqword_t)(sword_t)GPR(RS) * (sword_t)GPR(RT));
+  else
+    prod = (qword_t)(word_t)GPR(RS) * (word_t)GPR(RT);
+  SET_LO((word_t)prod);
+  SET_HI((word_t)(prod >> 32));
+}
+#endif /* HOST_HAS_QWORD */
+
+/* execute the instruction at pc with its machine.def semantics: the
+   registers are written at once, loads and stores go through dl1.  Every
+   instruction executes in one stage, control transfers in ID, loads and
+   stores in MEM, system calls in WB and the others in EX; the stages run
+   from WB back to IF in a cycle, so all the instructions ahead have
+   executed by then, but for loads and stores still in EX, which the
+   hazard checks of ID wait for */
+static void
+pipe_exec(md_inst_t inst, md_addr_t pc)
+{
+  enum md_opcode op;
+  enum md_fault_type fault = md_fault_none;
+
+  MD_SET_OPCODE(op, inst);
+  regs.regs_PC = pc;
+  regs.regs_NPC = pc + sizeof(md_inst_t);
+  /* maintain $r0 semantics */
+  regs.regs_R[MD_REG_ZERO] = 0;
+
+#ifdef HOST_HAS_QWORD
+  if (op == MULT || op == MULTU) {
+    mdu_mult(inst, op);
+    return;
+  }
+#endif /* HOST_HAS_QWORD */
+  switch (op) {
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+  case OP:								\
+    SYMCAT(OP,_IMPL);							\
+    break;
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
+  case OP:								\
+    panic("attempted to execute a linking opcode");
+#define CONNECT(OP)
+#include "machine.def"
+  default:
+    panic("attempted to execute a bogus opcode");
+  }
+
+  if (fault != md_fault_none)
+    fatal("fault (%d) detected @ 0x%08p", fault, pc);
 }
 
 /* since load-use hazard can't be forwarding*/
 void do_pipeline_ctl() {
-  /* insert NOP for load hazard */
+  int r, i, j;
+  /* release the registers whose load miss has completed */
+  for (r = 0; ctl.miss && r < MD_NUM_IREGS; ++r) {
+    if (((ctl.miss >> r) & 1) && ctl.ready[r] <= sim_num_cycle) {
+      ctl.miss &= ~(1u << r);
+      ctl.dst &= ~(1u << r);
+    }
+  }
+  /* insert NOP for load hazard: the slots ID held back go back to IF,
+     first, and the ones it issued go on */
   if(ctl.dh) {
-    fd.PC = de.PC;
-    fd.inst = de.inst;
-    de.inst.a = NOP;
+    for (i = 0; i < pipe_width; ++i) {
+      j = ctl.stall + i;
+      if (j < pipe_width) {
+        fd[i].PC = de[j].PC;
+        fd[i].NPC = de[j].NPC;
+        fd[i].inst = de[j].inst;
+        de[j].inst.a = NOP;
+      } else {
+        fd[i].PC = de[pipe_width - 1].NPC;
+        fd[i].NPC = de[pipe_width - 1].NPC;
+        fd[i].inst.a = NOP;
+      }
+    }
   }
 }
 
 void do_if()
 {
-  
+  md_inst_t inst;
+  md_addr_t pc;
+  enum md_opcode op;
+  unsigned int cycles = 0, slot_cycles;
+  int squash = FALSE, i, end = FALSE;
+
+  /* fetch goes on at the PC predicted for the last instruction in fd,
+     unless ID found it goes elsewhere */
   if(ctl.ch) {
-    fd.NPC = de.target;
+    pc = ctl.target;
     ctl.ch = FALSE;
+    /* the fetch of this cycle is down the wrong path and is thrown away,
+       the right one starts next cycle; a perfect predictor never took it */
+    squash = !bpred.perfect;
   } else {
-    fd.NPC = fd.PC + sizeof(md_inst_t);
+    pc = fd[pipe_width - 1].NPC;
   }
-  /* instruction fetch */
-  md_inst_t inst;
-  fd.PC = fd.NPC;
-  unsigned int cycles = MISS_LATENCY;
-  if (cache.isEnabled) {
-    cycles = cache_read(&cache, fd.PC, &(inst.a));
-    cycles += cache_read(&cache, fd.PC + 4, &(inst.b));
-  } else {
-    MD_FETCH_INSTI(inst, mem, fd.PC);
+  /* a group is fetched from consecutive PCs, and ends at a control
+     instruction, so fetch goes on at its predicted target next cycle */
+  for (i = 0; i < pipe_width && !end; ++i) {
+    if (fetch_limit && fetch_count == fetch_limit) {
+      /* fetching stopped, the run goes on from the first next PC that a
+         load hazard does not throw away */
+      if (!ctl.dh && !fetch_stopped) {
+        fetch_stopped = TRUE;
+        fetch_resume = pc;
+      }
+      squash = FALSE;
+      break;
+    }
+    /* instruction fetch */
+    fd[i].PC = squash ? fd[pipe_width - 1].NPC : pc;
+    if (trace) {
+      trace_put(trace, TRACE_IFETCH, fd[i].PC, fd[i].PC);
+      trace_put(trace, TRACE_IFETCH, fd[i].PC + 4, fd[i].PC);
+    }
+    slot_cycles = MISS_LATENCY;
+    if (il1.isEnabled) {
+      slot_cycles = cache_read(&il1, fd[i].PC, fd[i].PC, &(inst.a));
+      slot_cycles += cache_read(&il1, fd[i].PC + 4, fd[i].PC, &(inst.b));
+    } else {
+      MD_FETCH_INSTI(inst, mem, fd[i].PC);
+    }
+    /* the slots are read from il1 side by side */
+    if (slot_cycles > cycles)
+      cycles = slot_cycles;
+    if (squash)
+      break;
+    fd[i].inst = inst;
+    fd[i].NPC = pc = bpred_lookup(fd[i].PC, inst, !ctl.dh);
+    /* a fetch is redone after a load hazard */
+    if (!ctl.dh) {
+      ++fetch_count;
+      ++run_insn;
+    }
+    MD_SET_OPCODE(op, inst);
+    end = MD_OP_FLAGS(op) & F_CTRL;
   }
-  fd.inst = inst;
   INC_CYCLE_CTR(cycles);
-
+  if (squash) {
+    fd[0].inst.a = NOP;
+    fd[0].NPC = pc;
+    i = 1;
+  }
+  for (; i < pipe_width; ++i) {
+    fd[i].PC = pc;
+    fd[i].NPC = pc;
+    fd[i].inst.a = NOP;
+  }
 }
 
-void do_id() {
-    de.inst = fd.inst;
-    de.PC = fd.PC;
-    de.rwflag= 0;
-    if(NOP == de.inst.a) return;
-    MD_SET_OPCODE(de.opcode, de.inst);
-    md_inst_t inst = de.inst;
+/* the opcode, flags and operands of d->inst, from machine.def */
+static void pipe_decode(struct idex_buf *d) {
+  md_inst_t inst = d->inst;
+  MD_SET_OPCODE(d->opcode, inst);
+  switch (d->opcode) {
 #define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)\
-  if (OP==de.opcode){\
-    de.iflags = FLAGS;\
-    de.oprand.out1 = O1;\
-    de.oprand.out2 = O2;\
-    de.oprand.in1 = I1;\
-    de.oprand.in2 = I2;\
-    de.oprand.in3 = I3;\
-    goto READ_OPRAND_VALUE;\
-  }
-#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)
+  case OP:\
+    d->iflags = FLAGS;\
+    d->oprand.out1 = O1;\
+    d->oprand.out2 = O2;\
+    d->oprand.in1 = I1;\
+    d->oprand.in2 = I2;\
+    d->oprand.in3 = I3;\
+    break;
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)\
+  case OP:\
+    panic("attempted to execute a linking opcode");
 #define CONNECT(OP)
 #include "machine.def"
-READ_OPRAND_VALUE:
-  /* check for stall */    
-  if((de.oprand.in1 >= 0 && (ctl.dst&1<<de.oprand.in1)) || (de.oprand.in2 >= 0 && (ctl.dst&1<<de.oprand.in2))) {
-    ctl.dh = TRUE;
-    return;
-  } else {
-    ctl.dh = FALSE;
-  }
-  
-  int oprA = GPR(de.oprand.in1);
-  int oprB = GPR(de.oprand.in2);
-
-  switch (de.opcode) {
-      case ADD:
-      case ADDU:
-      case ADDI:
-      case ADDIU:
-      case LW:
-      case SW:
-      case LUI:
-        de.func = ALU_ADD;
-        break;
-      case ANDI:
-        de.func = ALU_AND;
-        break;
-      case SLL:
-        de.func = ALU_SLL;
-        break;
-      case SLTI:
-        de.func = ALU_SLT;
-        break;
-      case JUMP:
-        ctl.ch = TRUE;
-        de.target = (fd.PC & 0xf0000000) | ((de.inst.b & 0x3ffffff) << 2);
-        de.func = ALU_NOP;
-        break;
-      case BNE:
-        if (em.dstR != DNA) {
-          if (em.dstR == de.oprand.in1)
-            oprA = em.alu;
-          else if (em.dstR == de.oprand.in2)
-            oprB = em.alu;
-        }
-        if (oprA ^ oprB) {
-          ctl.ch = TRUE;
-          de.target = fd.PC + 8 + ((de.inst.b & 0xffff) << 2);
-        }
-        de.func = ALU_NOP;
-        break;
-      case BEQ:
-        if (em.dstR != DNA) {
-          if (em.dstR == de.oprand.in1)
-            oprA = em.alu;
-          else if (em.dstR == de.oprand.in2)
-            oprB = em.alu;
-        }
-        if (oprA == oprB) {
-          ctl.ch = TRUE;
-          de.target = fd.PC + 8 + ((de.inst.b & 0xffff) << 2);
-        }
-        de.func = ALU_NOP;
-        break;
-      case MULTU:
-        de.func = ALU_MULT;
-        break;
-      case MFLO:
-        SET_GPR(de.oprand.out1, LO);
-        de.func = ALU_NOP;
-        break;
-      default:
-        de.func = ALU_NOP;
-        break;
-  }
-  /* src A*/
-  if(de.iflags & F_DISP) {
-    de.srcA = de.oprand.in2; 
-  } else {
-    de.srcA = de.oprand.in1; 
-  }
-  /* src B */
-  de.srcB = de.oprand.in2;
-  
-  /* store */
-  if(de.iflags&F_STORE) {
-    de.rwflag |= 2;    
-  }
-  /* dst/read */ 
-  if(de.iflags&F_LOAD) {
-    de.rwflag |= 4;
-    de.dstM = de.oprand.out1;
-    de.dstR = DNA;
-    /* write-in register */
-    ctl.dst |= 1 << de.oprand.out1;
-  } else {
-    de.dstR = de.oprand.out1;
-    de.dstM = DNA;
+  default:
+    panic("attempted to execute a bogus opcode");
   }
-  do_forward();
 }
 
-void do_ex() {
-  em.inst = de.inst;
-  em.PC = de.PC;
-  em.dstR = de.dstR;
-  em.dstM = de.dstM;  
-  em.sw = de.sw;
-  em.rwflag = de.rwflag;
-  em.target = de.target;
-  /* alu A */
-  int aluA = de.busA;
-  /* alu B */  
-  int aluB;
-  if(de.iflags&F_IMM || de.iflags&F_DISP) {
-    aluB = (int)(short)(em.inst.b & 0xffff);
-  } else if(de.func == ALU_SLL) {
-    aluB = em.inst.b & 0xff;
-  } else {
-    aluB = de.busB; 
+/* the units an instruction takes in EX or MEM, as an index of fu_max:
+   none, an ALU, the multiply/divide unit, a memory port or an FP unit */
+static int fu_group(enum md_opcode op) {
+  switch (MD_OP_FUCLASS(op)) {
+  case FUClass_NA: return 0;
+  case IntALU: return 1;
+  case IntMULT: case IntDIV: return 2;
+  case RdPort: case WrPort: return 3;
+  default: return 4;
   }
-  /* alu part */
-  switch(de.func) {
-    case ALU_ADD:
-      em.alu = aluA + aluB;
-      break;
-    case ALU_SUB:
-      em.alu = aluA - aluB;
-      break;
-    case ALU_AND:
-      em.alu = aluA & aluB;
-      break;
-    case ALU_SLT:
-      em.alu = aluA < aluB;      
-      break;
-    case ALU_SLL:
-      em.alu = aluA << aluB;
-      break;
-    case ALU_MULT: {
-        SET_HI(0);
-        SET_LO(0);
-        int _i;
-        if (GPR(aluB) & 020000000000) {
-          SET_LO(aluA);
-        }
-        for (_i = 0; _i < 31; ++_i) {
-          SET_HI(HI << 1);
-          SET_HI(HI + extractl(LO, 31, 1));
-          SET_LO(LO << 1);
-          if ((extractl(aluB, 30 - _i, 1)) == 1)	{
-            if (((unsigned)037777777777 - (unsigned)LO) < (unsigned)aluA) {
-              SET_HI(HI + 1);
-            }
-            SET_LO(LO + aluA);	
-          }
-        }
-      }
-      break;
-    default:
-      em.alu = 0;
-      break;
+}
+
+/* if the operands read or write register R, $r0 is never a dependence */
+#define OPR_READS(O, R)		((R) > 0 && ((O)->in1 == (R) || (O)->in2 == (R) || (O)->in3 == (R)))
+#define OPR_WRITES(O, R)	((R) > 0 && ((O)->out1 == (R) || (O)->out2 == (R)))
+
+/* TRUE if the instruction in slot i of the ID group cannot issue with
+   the older ones of the group: it reads or writes a register one of them
+   writes, writes one they read, follows a system call, or finds all the
+   units of its kind taken */
+static int group_conflict(int i) {
+  oprand_t *y = &de[i].oprand, *o;
+  int j, used = 1, fu = fu_group(de[i].opcode);
+
+  for (j = 0; j < i; ++j) {
+    if (de[j].inst.a == NOP)
+      continue;
+    o = &de[j].oprand;
+    if (de[j].inst.a == SYSCALL
+        || OPR_READS(y, o->out1) || OPR_READS(y, o->out2)
+        || OPR_WRITES(y, o->out1) || OPR_WRITES(y, o->out2)
+        || OPR_READS(o, y->out1) || OPR_READS(o, y->out2))
+      return TRUE;
+    if (fu_group(de[j].opcode) == fu)
+      ++used;
   }
+  return used > fu_max[fu];
 }
 
-void do_mem() {
-  enum md_fault_type _fault;
-  unsigned int cycles = 0;
-  
-  mw.inst = em.inst;
-  mw.dstR = em.dstR;
-  mw.dstM = em.dstM;
-  mw.alu = em.alu;
-  mw.sw = em.sw;
-  mw.PC = em.PC;
-  mw.rwflag = em.rwflag;
-  if (mw.rwflag & 2) {
+void do_id() {
+  int i, sys_ahead = FALSE, mem_ahead = FALSE;
+  md_addr_t npc;
+
+  for (i = 0; i < pipe_width; ++i) {
+    de[i].inst = fd[i].inst;
+    de[i].PC = fd[i].PC;
+    de[i].NPC = fd[i].NPC;
+    de[i].rwflag= 0;
+    if (em[i].inst.a == SYSCALL || mw[i].inst.a == SYSCALL)
+      sys_ahead = TRUE;
+    if (em[i].rwflag)
+      mem_ahead = TRUE;
+  }
+  ctl.dh = FALSE;
+
+  /* the slots issue in order, up to the first one that must wait */
+  for (i = 0; i < pipe_width; ++i) {
+    if(NOP == de[i].inst.a) continue;
+    pipe_decode(&de[i]);
+
+    /* check for stall: a load ahead has not brought in a register read
+       here yet, a system call ahead has not run, a load or store right
+       ahead still has to use the register a jal or jalr links, HI/LO are
+       read before the multiply/divide unit writes them, or the unit cannot
+       take another operation yet */
+    if((IREG_BIT(de[i].oprand.in1) & ctl.dst) || (IREG_BIT(de[i].oprand.in2) & ctl.dst)
+       || (IREG_BIT(de[i].oprand.in3) & ctl.dst)
+       || sys_ahead
+       || ((de[i].iflags & F_CTRL) && IREG_BIT(de[i].oprand.out1) && mem_ahead)
+       || ((de[i].oprand.in1 == DHI || de[i].oprand.in1 == DLO) && ctl.hilo > sim_num_cycle)
+       || ((MD_OP_FUCLASS(de[i].opcode) == IntMULT || MD_OP_FUCLASS(de[i].opcode) == IntDIV)
+           && ctl.mdu > sim_num_cycle)) {
+      ctl.dh = TRUE;
+    } else if (i && group_conflict(i)) {
+      /* the group splits here, the rest issues next cycle */
+      ctl.dh = TRUE;
+      ++ctl.splitCounter;
+    }
+    if (ctl.dh) {
+      ctl.stall = i;
+      return;
+    }
+
+    /* control transfers resolve here; fetch went on at the PC predicted
+       for this instruction, redirect it if that was wrong */
+    npc = de[i].PC + sizeof(md_inst_t);
+    if (de[i].iflags & F_CTRL) {
+      pipe_exec(de[i].inst, de[i].PC);
+      npc = regs.regs_NPC;
+    }
+    ctl.ch = bpred_update(de[i].PC, de[i].inst, npc, de[i].NPC);
+
     /* store */
-    if (cache.isEnabled) {
-      cycles = cache_write(&cache, mw.alu, &mw.sw);
-    } else {
-      WRITE_WORD(mw.sw, mw.alu, _fault);
-      cycles = MISS_LATENCY;
+    if(de[i].iflags&F_STORE) {
+      de[i].rwflag |= 2;    
     }
-  } else if (mw.rwflag & 4) {
-    /* load */
-    if (cache.isEnabled) {
-      cycles = cache_read(&cache, mw.alu, &mw.memLoad);
+    /* dst/read */ 
+    if(de[i].iflags&F_LOAD) {
+      de[i].rwflag |= 4;
+      de[i].dstM = de[i].oprand.out1;
+      de[i].dstR = DNA;
+      /* write-in registers, dlw writes a pair */
+      de[i].ldmask = IREG_BIT(de[i].oprand.out1) | IREG_BIT(de[i].oprand.out2);
+      if (de[i].opcode == DLW)
+        de[i].ldmask |= de[i].ldmask << 1;
+      ctl.dst |= de[i].ldmask;
     } else {
-      mw.memLoad = READ_WORD(mw.alu, _fault);
-      cycles = MISS_LATENCY;
+      de[i].dstR = de[i].oprand.out1;
+      de[i].dstM = DNA;
+      de[i].ldmask = 0;
+    }
+
+    /* a control instruction is the last of its group */
+    if (ctl.ch) {
+      ctl.target = npc;
+      return;
     }
-    ctl.dst &= ~(1 << mw.dstM);
   }
-  INC_CYCLE_CTR(cycles);
+}
+
+void do_ex() {
+  int i;
+  for (i = 0; i < pipe_width; ++i) {
+    em[i].inst = de[i].inst;
+    em[i].PC = de[i].PC;
+    em[i].dstR = de[i].dstR;
+    em[i].dstM = de[i].dstM;  
+    em[i].ldmask = de[i].ldmask;
+    em[i].rwflag = de[i].rwflag;
+    em[i].alu = 0;
+    /* control transfers executed in ID, loads and stores wait for MEM and
+       system calls for WB */
+    if (em[i].inst.a == NOP || (de[i].iflags & (F_CTRL | F_MEM)) || em[i].inst.a == SYSCALL)
+      continue;
+    pipe_exec(em[i].inst, em[i].PC);
+    if (IREG_BIT(em[i].dstR))
+      em[i].alu = GPR(em[i].dstR);
+    /* the multiply/divide unit is pipelined, only readers of HI/LO wait
+       for its latency */
+    if (MD_OP_FUCLASS(de[i].opcode) == IntMULT) {
+      ctl.hilo = sim_num_cycle + mult_lat - 1;
+      ctl.mdu = sim_num_cycle + mult_ii - 1;
+    } else if (MD_OP_FUCLASS(de[i].opcode) == IntDIV) {
+      ctl.hilo = sim_num_cycle + div_lat - 1;
+      ctl.mdu = sim_num_cycle + div_ii - 1;
+    }
+  }
+}
 
-  if(mw.dstR != DNA) {
-    SET_GPR(mw.dstR, mw.alu);
+void do_mem() {
+  unsigned int r, cycles = 0;
+  int i;
+  
+  for (i = 0; i < pipe_width; ++i) {
+    mw[i].inst = em[i].inst;
+    mw[i].dstR = em[i].dstR;
+    mw[i].dstM = em[i].dstM;
+    mw[i].ldmask = em[i].ldmask;
+    mw[i].alu = em[i].alu;
+    mw[i].PC = em[i].PC;
+    mw[i].rwflag = em[i].rwflag;
+    mw[i].memLoad = 0;
+    if (!mw[i].rwflag)
+      continue;
+
+    mem_cycles = 0;
+    pipe_exec(mw[i].inst, mw[i].PC);
+    if (mw[i].rwflag & 4) {
+      /* load */
+      if (IREG_BIT(mw[i].dstM))
+        mw[i].memLoad = GPR(mw[i].dstM);
+      ctl.miss &= ~mw[i].ldmask;
+      if (dl1.isEnabled && dl1.nmshr && dl1.done > sim_num_cycle + mem_cycles) {
+        /* the miss goes on in an MSHR, only the instructions reading the
+           registers wait for it */
+        ctl.miss |= mw[i].ldmask;
+        for (r = 0; r < MD_NUM_IREGS; ++r) {
+          if ((mw[i].ldmask >> r) & 1)
+            ctl.ready[r] = dl1.done;
+        }
+      } else {
+        ctl.dst &= ~mw[i].ldmask;
+      }
+    }
+    /* the memory ports work side by side */
+    if (mem_cycles > cycles)
+      cycles = mem_cycles;
   }
+  INC_CYCLE_CTR(cycles);
 }                                                                         
 
+/* print pipeline statistics */
+static void pipe_log() {
+  printf("[pipe] Total number of instructions committed: %d\n", ctl.commitCounter);
+  printf("[pipe] Total number of ID groups split: %d\n", ctl.splitCounter);
+  if (sim_num_cycle)
+    printf("[pipe] IPC: %.3f\n", (double)ctl.commitCounter / sim_num_cycle);
+}
+
 void do_wb() {
-  wb.inst = mw.inst;
-  wb.PC = mw.PC;
-  wb.dstR = mw.dstR;
-  wb.dstM = mw.dstM;
-  wb.alu = mw.alu;
-  wb.memLoad = mw.memLoad;
-  if(mw.dstM != DNA) {
-    SET_GPR(mw.dstM, mw.memLoad);
-  }
-  if(wb.inst.a == SYSCALL){
-    cache_flush(&cache);
-    cache_log(&cache);
-    SYSCALL(wb.inst);
+  int i;
+  for (i = 0; i < pipe_width; ++i) {
+    wb[i].inst = mw[i].inst;
+    wb[i].PC = mw[i].PC;
+    wb[i].dstR = mw[i].dstR;
+    wb[i].dstM = mw[i].dstM;
+    wb[i].alu = mw[i].alu;
+    wb[i].memLoad = mw[i].memLoad;
+    if (wb[i].inst.a == NOP)
+      continue;
+    ++ctl.commitCounter;
+    if(wb[i].inst.a == SYSCALL){
+      cache_flush_all();
+      cache_log_all();
+      bpred_log();
+      pipe_log();
+      /* the program may exit in the window of a worker */
+      if (ck_worker)
+        sample_measure(ck_worker);
+      SYSCALL(wb[i].inst);
+    }
   }
 }
 
 void do_log()
 {
-  enum md_fault_type _fault;
+  int i;
 	printf("[Cycle %3d]---------------------------------\n", sim_num_insn);
-	printf("[IF]  ");md_print_insn(fd.inst, fd.PC, stdout);printf("\n");
-	printf("[ID]  ");md_print_insn(de.inst, de.PC, stdout);printf("\n");
-	printf("[EX]  ");md_print_insn(em.inst, em.PC, stdout);printf("\n");
-	printf("[MEM] ");md_print_insn(mw.inst, mw.PC, stdout);printf("\n");
-	printf("[WB]  ");md_print_insn(wb.inst, wb.PC, stdout);printf("\n");
-	printf("[REGS]r0=%d r4=%d r6=%d r8=%d r16=%d r17=%d r18=%d mem = %d\n", GPR(0), GPR(4), GPR(6),GPR(8),GPR(16),GPR(17),GPR(18),READ_WORD(GPR(30)+16, _fault));
+  for (i = 0; i < pipe_width; ++i) {
+	printf("[IF]  ");md_print_insn(fd[i].inst, fd[i].PC, stdout);printf("\n");
+  }
+  for (i = 0; i < pipe_width; ++i) {
+	printf("[ID]  ");md_print_insn(de[i].inst, de[i].PC, stdout);printf("\n");
+  }
+  for (i = 0; i < pipe_width; ++i) {
+	printf("[EX]  ");md_print_insn(em[i].inst, em[i].PC, stdout);printf("\n");
+  }
+  for (i = 0; i < pipe_width; ++i) {
+	printf("[MEM] ");md_print_insn(mw[i].inst, mw[i].PC, stdout);printf("\n");
+  }
+  for (i = 0; i < pipe_width; ++i) {
+	printf("[WB]  ");md_print_insn(wb[i].inst, wb[i].PC, stdout);printf("\n");
+  }
+	printf("[REGS]r0=%d r4=%d r6=%d r8=%d r16=%d r17=%d r18=%d mem = %d\n", GPR(0), GPR(4), GPR(6),GPR(8),GPR(16),GPR(17),GPR(18),MEM_READ_WORD(mem, GPR(30)+16));
 	printf("--------------------------------------------\n");
 }
 
-/* cahce */
+/* run the out-of-order engine from regs.regs_PC to the end of the run:
+   each instruction executes in program order as it is fetched, with its
+   fetch, loads and stores through the caches at the cycle of its fetch,
+   and ooo_insn() works out when it would have issued and committed */
+static void ooo_run() {
+  struct idex_buf d;
+  struct ooo_inst oi;
+  md_addr_t pred;
+  unsigned int fetch_cycles;
 
-void enque_cache_set(struct cache_set* sp, struct cache_line* lp) {
-  if (sp->tail != NULL) {
-    sp->tail->next = lp;
-  }
-  sp->tail = lp;
-  if (sp->head == NULL) {
-    sp->head = lp;
-  }
-  ++sp->n;
-}
+  regs.regs_NPC = regs.regs_PC + sizeof(md_inst_t);
+  while (TRUE) {
+    sim_num_cycle = (unsigned int)ooo.fetch;
+    d.PC = regs.regs_PC;
+    if (trace) {
+      trace_put(trace, TRACE_IFETCH, d.PC, d.PC);
+      trace_put(trace, TRACE_IFETCH, d.PC + 4, d.PC);
+    }
+    fetch_cycles = MISS_LATENCY;
+    if (il1.isEnabled) {
+      fetch_cycles = cache_read(&il1, d.PC, d.PC, &(d.inst.a));
+      fetch_cycles += cache_read(&il1, d.PC + 4, d.PC, &(d.inst.b));
+    } else {
+      MD_FETCH_INSTI(d.inst, mem, d.PC);
+    }
+    pipe_decode(&d);
+    pred = bpred_lookup(d.PC, d.inst, TRUE);
 
-void deque_cache_set(struct cache_set* sp) {
-  if (sp->n == 0) {
-    return;
-  }
-  struct cache_line* head = sp->head;
-  sp->head = sp->head->next;
-  --sp->n;
-  if (sp->n == 0) {
-    sp->tail == NULL;
+    mem_cycles = 0;
+    if (d.inst.a == SYSCALL) {
+      regs.regs_NPC = d.PC + sizeof(md_inst_t);
+    } else {
+      pipe_exec(d.inst, d.PC);
+      /* a load miss in an MSHR goes on past the access */
+      if ((d.iflags & F_LOAD) && dl1.isEnabled && dl1.nmshr
+          && dl1.done > sim_num_cycle + mem_cycles)
+        mem_cycles = dl1.done - sim_num_cycle;
+    }
+
+    oi.in[0] = d.oprand.in1;
+    oi.in[1] = d.oprand.in2;
+    oi.in[2] = d.oprand.in3;
+    oi.out[0] = d.oprand.out1;
+    oi.out[1] = d.oprand.out2;
+    oi.fu = MD_OP_FUCLASS(d.opcode);
+    oi.flags = d.iflags;
+    oi.addr = mem_addr;
+    oi.lat = 0;
+    oi.miss = 0;
+    if (d.iflags & F_LOAD) {
+      oi.lat = mem_cycles;
+      oi.miss = mem_cycles > HIT_LATENCY ? mem_cycles - HIT_LATENCY : 0;
+    } else if (oi.fu == IntMULT) {
+      oi.lat = mult_lat;
+    } else if (oi.fu == IntDIV) {
+      oi.lat = div_lat;
+    }
+    oi.fetch_stall = fetch_cycles > 2 * HIT_LATENCY ? fetch_cycles - 2 * HIT_LATENCY : 0;
+    oi.mispred = bpred_update(d.PC, d.inst, regs.regs_NPC, pred) && !bpred.perfect;
+    oi.serial = d.inst.a == SYSCALL;
+    ooo_insn(&oi);
+    INC_INSN_CTR();
+    ++run_insn;
+
+    if (oi.serial) {
+      sim_num_cycle = (unsigned int)ooo.commit;
+      cache_flush_all();
+      cache_log_all();
+      bpred_log();
+      ooo_log();
+      SYSCALL(d.inst);
+    }
+    regs.regs_PC = regs.regs_NPC;
   }
-  free(head);
 }
 
-void cache_do_read(struct cache_line* lp, unsigned int offset, word_t* dst) {
-  memcpy(dst, (void *)(&lp->data)+offset, sizeof(word_t));   
-}
 
-void cache_do_write(struct cache_line* lp, unsigned int offset, word_t* src) {
-  memcpy((void *)(&lp->data)+offset, src, sizeof(word_t));
-  lp->dirty = 1;
+/*
+ * fast forward, the functional engine of sim-fast
+ */
+
+/* read SIZE bytes at ADDR, through dl1 when warming the caches up */
+static word_t
+ff_read(md_addr_t addr, int size)
+{
+  word_t word, val = 0;
+
+  if (!fastfwd_warm || !dl1.isEnabled) {
+    switch (size) {
+    case 1: return MEM_READ_BYTE(mem, addr);
+    case 2: return MEM_READ_HALF(mem, addr);
+    default: return MEM_READ_WORD(mem, addr);
+    }
+  }
+  /* the caches hold the data, and may be newer than memory */
+  INC_CYCLE_CTR(cache_read(&dl1, addr & ~3, regs.regs_PC, &word));
+  memcpy(&val, (char *)&word + (addr & 3), size);
+  return val;
 }
 
-unsigned int cache_access(struct cache* cp, md_addr_t addr, word_t* wp, cache_func func) {
-  unsigned int tag = ADDR_TAG(addr);
-  unsigned int idx = ADDR_IDX(addr);
-  unsigned int offset = ADDR_OFFSET(addr);
-  
-  struct cache_set* sp = &cp->sets[idx];
-  struct cache_line* lp = NULL;
-  md_addr_t align_addr = addr & (~0xF);
-
-  unsigned int cycles = HIT_LATENCY;
-  unsigned int miss = 1;
-  ++cp->accessCounter;
-
-  for (lp = sp->head; lp != NULL; lp = lp->next) {
-    if (lp->valid && tag == lp->tag) {
-      miss = 0;
-      ++lp->ref_count;
-      ++cp->hitCounter;
-      func(lp, offset, wp);
-      break;
+/* write the SIZE low bytes of VAL at ADDR, through dl1 when warming the
+   caches up */
+static void
+ff_write(md_addr_t addr, word_t val, int size)
+{
+  word_t word;
+
+  if (!fastfwd_warm || !dl1.isEnabled) {
+    switch (size) {
+    case 1: MEM_WRITE_BYTE(mem, addr, val); break;
+    case 2: MEM_WRITE_HALF(mem, addr, val); break;
+    default: MEM_WRITE_WORD(mem, addr, val); break;
     }
+    return;
   }
-  
-  if (miss) {
-    cycles = MISS_LATENCY;
-    ++cp->missCounter;
-    lp = malloc_cache_line(align_addr);
-    add_cache_line(sp, idx, lp);
-    func(lp, offset, wp);
+  if (size < 4) {
+    /* the caches are written a word at a time */
+    INC_CYCLE_CTR(cache_read(&dl1, addr & ~3, regs.regs_PC, &word));
+    memcpy((char *)&word + (addr & 3), &val, size);
+  } else {
+    word = val;
   }
-  return cycles;
+  INC_CYCLE_CTR(cache_write(&dl1, addr & ~3, regs.regs_PC, &word));
 }
 
-unsigned int cache_read(struct cache* cp, md_addr_t addr, word_t* wp) {
-  return cache_access(cp, addr, wp, cache_do_read);
+/* system call of the fast forward, memory must be up to date first as in
+   do_wb() */
+static void
+ff_syscall(md_inst_t inst)
+{
+  if (fastfwd_warm)
+    cache_flush_all();
+  sys_syscall(&regs, mem_access, mem, inst, TRUE);
 }
 
-unsigned int cache_write(struct cache* cp, md_addr_t addr, word_t* wp) {
-  return cache_access(cp, addr, wp, cache_do_write);
-}
+#undef READ_BYTE
+#undef READ_HALF
+#undef READ_WORD
+#undef WRITE_BYTE
+#undef WRITE_HALF
+#undef WRITE_WORD
+#undef SYSCALL
+#undef DECLARE_FAULT
 
-struct cache_line* malloc_cache_line(md_addr_t addr) {
-  struct cache_line* lp = malloc(sizeof(struct cache_line));
-  enum md_fault_type _fault;
-  int i;
-  for (i = 0; i < SET_WAYS; ++i) {
-    lp->data[i] = READ_WORD(addr + (i * 4), _fault);
-  }
-  lp->ref_count = 0;
-  lp->tag = ADDR_TAG(addr);
-  lp->valid = 1;
-  lp->dirty = 0;
-  lp->next = NULL;
-  return lp;
-}
+#define READ_BYTE(SRC, FAULT)						\
+  ((FAULT) = md_fault_none, ff_read((SRC), 1))
+#define READ_HALF(SRC, FAULT)						\
+  ((FAULT) = md_fault_none, ff_read((SRC), 2))
+#define READ_WORD(SRC, FAULT)						\
+  ((FAULT) = md_fault_none, ff_read((SRC), 4))
 
-void cache_write_back(struct cache_line* lp, unsigned int idx) {
-  md_addr_t addr = (lp->tag << 8) | (idx << 4);
-  enum md_fault_type _fault;
-  int i;
-  for (i = 0; i < SET_WAYS; ++i) {
-    WRITE_WORD(lp->data[i], addr + (i * 4), _fault);
-  }
-  lp->dirty = 0;
-}
+#define WRITE_BYTE(SRC, DST, FAULT)					\
+  ((FAULT) = md_fault_none, ff_write((DST), (SRC), 1))
+#define WRITE_HALF(SRC, DST, FAULT)					\
+  ((FAULT) = md_fault_none, ff_write((DST), (SRC), 2))
+#define WRITE_WORD(SRC, DST, FAULT)					\
+  ((FAULT) = md_fault_none, ff_write((DST), (SRC), 4))
+
+#define SYSCALL(INST)	ff_syscall(INST)
+
+/* execute COUNT instructions from regs.regs_PC as sim-fast does, leaving
+   regs.regs_PC at the next one; with -fastfwd:warm the fetches, loads and
+   stores also go through the caches */
+static void
+fast_forward(counter_t count)
+{
+  md_inst_t inst;
+  enum md_opcode op;
+  enum md_fault_type fault;
+  word_t word;
+  counter_t n;
+
+  fprintf(stderr, "sim: ** fast forwarding %.0f insts **\n", (double)count);
 
-void add_cache_line(struct cache_set* sp, unsigned int idx, struct cache_line* lp) {
-  if (sp->n >= SET_WAYS) {
-    if (sp->head->dirty) {
-      ++cache.wbCounter;
-      cache_write_back(sp->head, idx);
+  regs.regs_NPC = regs.regs_PC + sizeof(md_inst_t);
+  for (n = 0; n < count; ++n) {
+    /* maintain $r0 semantics */
+    regs.regs_R[MD_REG_ZERO] = 0;
+
+    if (fastfwd_warm && il1.isEnabled) {
+      INC_CYCLE_CTR(cache_read(&il1, regs.regs_PC, regs.regs_PC, &word));
+      INC_CYCLE_CTR(cache_read(&il1, regs.regs_PC + 4, regs.regs_PC, &word));
     }
-    ++cache.replaceCounter;
-    deque_cache_set(sp);
-  }
-  enque_cache_set(sp, lp);
-}
+    MD_FETCH_INST(inst, mem, regs.regs_PC);
+    MD_SET_OPCODE(op, inst);
+    fault = md_fault_none;
 
-unsigned int cache_flush(struct cache* cp) {
-  struct cache_set* sp;
-  struct cache_line* lp;
-  int i;
-  for (i = 0; i < SET_NUM; ++i) {
-    sp = &cp->sets[i];
-    for (lp = sp->head; lp != NULL; lp = lp->next) {
-      if (lp->dirty)
-      cache_write_back(lp, i);
+#ifdef HOST_HAS_QWORD
+    if (op == MULT || op == MULTU)
+      mdu_mult(inst, op);
+    else
+#endif /* HOST_HAS_QWORD */
+    switch (op) {
+#define DEFINST(OP,MSK,NAME,OPFORM,RES,FLAGS,O1,O2,I1,I2,I3)		\
+    case OP:								\
+      SYMCAT(OP,_IMPL);							\
+      break;
+#define DEFLINK(OP,MSK,NAME,MASK,SHIFT)					\
+    case OP:								\
+      panic("attempted to execute a linking opcode");
+#define CONNECT(OP)
+#define DECLARE_FAULT(FAULT)						\
+      { fault = (FAULT); break; }
+#include "machine.def"
+    default:
+      panic("attempted to execute a bogus opcode");
     }
-  }
-}
 
-void cache_log(struct cache* cp) {
-  printf("Total number of clock cycles: %d\n", sim_num_cycle);
-  printf("Total number of memory access: %d\n", cp->accessCounter);
-  printf("Total number of cache hits: %d\n", cp->hitCounter);
-  printf("Total number of cache misses: %d\n", cp->missCounter);
-  printf("Total number of cache line replacements: %d\n", cp->replaceCounter);
-  printf("Total number of cache line write backs: %d\n", cp->wbCounter);
+    if (fault != md_fault_none)
+      fatal("fault (%d) detected @ 0x%08p", fault, regs.regs_PC);
+
+    /* a warm fast forward trains the branch predictor as well */
+    if (fastfwd_warm && (MD_OP_FLAGS(op) & F_CTRL))
+      bpred_train(regs.regs_PC, inst, regs.regs_NPC);
+
+    ++sim_num_fastfwd;
+    ++run_insn;
+    regs.regs_PC = regs.regs_NPC;
+    regs.regs_NPC += sizeof(md_inst_t);
+  }
 }
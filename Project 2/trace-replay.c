@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* trace-replay: runs a cache access trace written by sim-pipe -cache:trace
+   through the cache hierarchy of sim-pipe, without the pipeline, so many
+   cache configurations can be measured from one run of the program. */
+
+#include "host.h"
+#include "misc.h"
+#include "machine.h"
+#include "memory.h"
+#include "options.h"
+#include "pipe-cache.h"
+#include "pipe-trace.h"
+
+/* clock of the replay, advanced by the latency of each access */
+unsigned int sim_num_cycle;
+
+/* print help and exit */
+static int help_me;
+
+/* file of the configurations of a sweep, NULL for a single replay */
+static char *sweep_name;
+
+/* argv index of the trace file */
+static int trace_arg = -1;
+
+/* accesses replayed of each kind */
+static counter_t n[TRACE_KINDS];
+
+#define SWEEP_MAX 256     /* configurations of a sweep */
+#define SWEEP_ARGS 64     /* options on one line of the sweep file */
+#define SWEEP_SLOTS 64     /* batches held by the ring */
+#define SWEEP_BATCH 4096     /* records of a batch */
+
+/* a decoded trace record */
+struct sweep_rec {
+  md_addr_t addr;
+  md_addr_t pc;
+  enum trace_kind kind;
+};
+
+struct sweep_batch {
+  unsigned int n;                   /* records used */
+  struct sweep_rec rec[SWEEP_BATCH];
+};
+
+/* single-producer, multi-consumer ring shared with the sweep workers: the
+   reader fills slot head % SWEEP_SLOTS and publishes it by bumping head,
+   every worker replays every batch and bumps its own tail, and a slot is
+   only refilled once each live worker is past it */
+struct sweep_ring {
+  volatile unsigned int head;       /* batches published */
+  volatile unsigned int done;       /* set after the last batch */
+  volatile unsigned int tail[SWEEP_MAX];    /* batches each worker replayed */
+  struct sweep_batch slot[SWEEP_SLOTS];
+};
+
+/* the trace file is the first argument that is not an option */
+static int
+orphan_fn(int i, int argc, char **argv)
+{
+  trace_arg = i;
+  return /* done */FALSE;
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* register the options of the replay, setting them to their defaults */
+static struct opt_odb_t *
+replay_reg_options(void)
+{
+  struct opt_odb_t *odb = opt_new(orphan_fn);
+  opt_reg_header(odb,
+"trace-replay: replays a sim-pipe cache trace through the cache hierarchy.\n"
+"  usage: trace-replay {-options} <trace>\n"
+		 );
+  opt_reg_flag(odb, "-h", "print help message",
+	       &help_me, /* default */FALSE, /* !print */FALSE, NULL);
+  opt_reg_string(odb, "-sweep",
+		 "replay the trace through each configuration of this file, "
+		 "one line of -cache options each, in parallel",
+		 &sweep_name, /* default */NULL,
+		 /* print */TRUE, /* format */NULL);
+  cache_reg_options(odb);
+  return odb;
+}
+
+/* build the cache hierarchy from the cache options */
+static void
+replay_init(void)
+{
+  /* the trace holds no data, lines are filled from a zeroed memory */
+  struct mem_t *mem = mem_create("mem");
+  mem_init(mem);
+  sim_num_cycle = 0;
+  cache_init(mem);
+}
+
+static void
+replay(enum trace_kind kind, md_addr_t addr, md_addr_t pc)
+{
+  word_t data = 0;
+  switch (kind) {
+  case TRACE_IFETCH:
+    sim_num_cycle += il1.isEnabled ? cache_read(&il1, addr, pc, &data) : MISS_LATENCY;
+    break;
+  case TRACE_READ:
+    sim_num_cycle += dl1.isEnabled ? cache_read(&dl1, addr, pc, &data) : MISS_LATENCY;
+    break;
+  case TRACE_WRITE:
+    sim_num_cycle += dl1.isEnabled ? cache_write(&dl1, addr, pc, &data) : MISS_LATENCY;
+    break;
+  default:
+    break;
+  }
+  ++n[kind];
+}
+
+static void
+replay_log(void)
+{
+  cache_flush_all();
+  cache_log_all();
+  printf("[trace] Total number of instruction fetches: %lld\n", (long long)n[TRACE_IFETCH]);
+  printf("[trace] Total number of loads: %lld\n", (long long)n[TRACE_READ]);
+  printf("[trace] Total number of stores: %lld\n", (long long)n[TRACE_WRITE]);
+}
+
+/* replay every batch of the ring through the configuration of one line of
+   the sweep file, laid over the options of the command line */
+static void
+sweep_worker(struct sweep_ring *ring, int w, char *line, int argc, char **argv)
+{
+  struct opt_odb_t *odb;
+  char *args[SWEEP_ARGS + 1];
+  int nargs = 1;
+  unsigned int pos = 0, i;
+  struct sweep_batch *b;
+  char *tok;
+
+  odb = replay_reg_options();
+  opt_process_options(odb, argc, argv);
+  args[0] = argv[0];
+  for (tok = strtok(line, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+    if (nargs > SWEEP_ARGS)
+      fatal("too many options on line %d of the sweep file", w + 1);
+    args[nargs++] = tok;
+  }
+  opt_process_options(odb, nargs, args);
+  cache_check_options();
+  replay_init();
+
+  for (;;) {
+    while (pos == ring->head && !ring->done)
+      sched_yield();
+    __sync_synchronize();
+    if (pos == ring->head)
+      break;
+    b = &ring->slot[pos % SWEEP_SLOTS];
+    for (i = 0; i < b->n; ++i)
+      replay(b->rec[i].kind, b->rec[i].addr, b->rec[i].pc);
+    __sync_synchronize();
+    ring->tail[w] = ++pos;
+  }
+  replay_log();
+  fflush(stdout);
+  exit(0);
+}
+
+/* wait until the slot after the last published one is free in every live
+   worker, reaping the workers that died */
+static struct sweep_batch *
+sweep_slot(struct sweep_ring *ring, pid_t *pid, int *alive, int nconf)
+{
+  unsigned int oldest;
+  pid_t p;
+  int w, status;
+  for (;;) {
+    oldest = ring->head;
+    for (w = 0; w < nconf; ++w) {
+      if (alive[w] && ring->tail[w] < oldest)
+        oldest = ring->tail[w];
+    }
+    if (ring->head - oldest < SWEEP_SLOTS)
+      break;
+    while ((p = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (w = 0; w < nconf; ++w) {
+        if (pid[w] == p)
+          alive[w] = FALSE;
+      }
+    }
+    sched_yield();
+  }
+  __sync_synchronize();
+  return &ring->slot[ring->head % SWEEP_SLOTS];
+}
+
+/* decode the trace once and fan it out to a worker for each configuration
+   of the sweep file; the cache model keeps its state in globals, so the
+   workers are processes and only the ring is shared */
+static void
+sweep(int argc, char **argv)
+{
+  char buf[1024];
+  char *lines[SWEEP_MAX];
+  FILE *out[SWEEP_MAX];
+  pid_t pid[SWEEP_MAX];
+  int alive[SWEEP_MAX];
+  int nconf = 0, w, status;
+  FILE *fp;
+  struct sweep_ring *ring;
+  struct sweep_batch *b;
+  struct trace_reader *tr;
+  enum trace_kind kind;
+  md_addr_t addr, pc;
+  counter_t records = 0;
+  double start, elapsed;
+
+  fp = fopen(sweep_name, "r");
+  if (!fp)
+    fatal("cannot open sweep file `%s'", sweep_name);
+  while (fgets(buf, sizeof(buf), fp)) {
+    /* skip blank lines and comments */
+    if (buf[strspn(buf, " \t\n")] == '\0' || buf[strspn(buf, " \t")] == '#')
+      continue;
+    if (nconf == SWEEP_MAX)
+      fatal("sweep file has more than %d configurations", SWEEP_MAX);
+    lines[nconf++] = strdup(buf);
+  }
+  fclose(fp);
+  if (!nconf)
+    fatal("sweep file `%s' has no configuration", sweep_name);
+
+  ring = (struct sweep_ring *)mmap(NULL, sizeof(struct sweep_ring),
+				   PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ring == (struct sweep_ring *)MAP_FAILED)
+    fatal("cannot map the sweep ring");
+  ring->head = ring->done = 0;
+
+  fflush(stdout);
+  for (w = 0; w < nconf; ++w) {
+    /* each worker writes its results to a file of its own, printed in
+       order once all are done */
+    out[w] = tmpfile();
+    if (!out[w])
+      fatal("cannot create a sweep output file");
+    ring->tail[w] = 0;
+    alive[w] = TRUE;
+    pid[w] = fork();
+    if (pid[w] < 0)
+      fatal("cannot fork a sweep worker");
+    if (pid[w] == 0) {
+      dup2(fileno(out[w]), fileno(stdout));
+      sweep_worker(ring, w, strdup(lines[w]), argc, argv);
+    }
+  }
+
+  tr = trace_open_read(argv[trace_arg]);
+  start = now();
+  b = sweep_slot(ring, pid, alive, nconf);
+  b->n = 0;
+  while (trace_get(tr, &kind, &addr, &pc)) {
+    b->rec[b->n].addr = addr;
+    b->rec[b->n].pc = pc;
+    b->rec[b->n].kind = kind;
+    if (++b->n == SWEEP_BATCH) {
+      __sync_synchronize();
+      ++ring->head;
+      b = sweep_slot(ring, pid, alive, nconf);
+      b->n = 0;
+    }
+    ++records;
+  }
+  __sync_synchronize();
+  if (b->n)
+    ++ring->head;
+  ring->done = TRUE;
+  trace_close_read(tr);
+
+  for (w = 0; w < nconf; ++w) {
+    if (alive[w] && waitpid(pid[w], &status, 0) == pid[w]
+	&& (!WIFEXITED(status) || WEXITSTATUS(status)))
+      alive[w] = FALSE;
+  }
+  elapsed = now() - start;
+
+  for (w = 0; w < nconf; ++w) {
+    printf("[sweep %d] %s", w, lines[w]);
+    if (!alive[w])
+      printf("[sweep %d] failed\n", w);
+    rewind(out[w]);
+    while (fgets(buf, sizeof(buf), out[w]))
+      fputs(buf, stdout);
+    fclose(out[w]);
+  }
+  if (elapsed > 0)
+    printf("[sweep] Replay speed: %.1f million accesses/s over %d configurations\n",
+	   records * nconf / elapsed / 1e6, nconf);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct opt_odb_t *odb;
+  struct trace_reader *tr;
+  enum trace_kind kind;
+  md_addr_t addr, pc;
+  double start, elapsed;
+
+  odb = replay_reg_options();
+  opt_process_options(odb, argc, argv);
+  if (help_me || trace_arg < 0) {
+    opt_print_help(odb, stderr);
+    exit(help_me ? 0 : 1);
+  }
+  cache_check_options();
+  opt_print_options(odb, stderr, /* short */TRUE, /* notes */TRUE);
+
+  if (sweep_name) {
+    sweep(argc, argv);
+    return 0;
+  }
+
+  replay_init();
+  tr = trace_open_read(argv[trace_arg]);
+  start = now();
+  while (trace_get(tr, &kind, &addr, &pc))
+    replay(kind, addr, pc);
+  elapsed = now() - start;
+  trace_close_read(tr);
+
+  replay_log();
+  if (elapsed > 0)
+    printf("[trace] Replay speed: %.1f million accesses/s\n",
+	   (n[TRACE_IFETCH] + n[TRACE_READ] + n[TRACE_WRITE]) / elapsed / 1e6);
+  return 0;
+}